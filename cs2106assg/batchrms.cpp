@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "batchrms.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Number of simulations processed together by one vector
+#define LANES	8
+
+#define AT(b, k, s)	((k) * (b)->stride + (s))
+
+static int *newArray(int n)
+{
+	return (int *) calloc(n, sizeof(int));
+}
+
+void initBatch(TBatch *batch, int numSims)
+{
+	// Round up so the vector loop never has to deal with a partial block.
+	// The extra simulations have no tasks and a zero horizon.
+	int stride = (numSims + LANES - 1) / LANES * LANES;
+
+	batch->numSims = numSims;
+	batch->stride = stride;
+	batch->horizonCap = 0;
+
+	batch->p = newArray(BATCH_MAX_TASKS * stride);
+	batch->c = newArray(BATCH_MAX_TASKS * stride);
+	batch->countdown = newArray(BATCH_MAX_TASKS * stride);
+	batch->timeLeft = newArray(BATCH_MAX_TASKS * stride);
+	batch->deadline = newArray(BATCH_MAX_TASKS * stride);
+	batch->state = newArray(BATCH_MAX_TASKS * stride);
+	batch->seq = newArray(BATCH_MAX_TASKS * stride);
+
+	batch->numTasks = newArray(stride);
+	batch->cur = newArray(stride);
+	batch->curLeft = newArray(stride);
+	batch->curDeadline = newArray(stride);
+	batch->horizon = newArray(stride);
+	batch->blockedBits = newArray(stride);
+	batch->relBits = newArray(stride);
+	batch->seqCounter = newArray(stride);
+	batch->missTicks = newArray(stride);
+	batch->idleTicks = newArray(stride);
+	batch->preemptions = newArray(stride);
+	batch->capped = newArray(stride);
+
+	int s;
+
+	for(s=0; s<stride; s++)
+		batch->cur[s] = -1;
+}
+
+int batchAddProcess(TBatch *batch, int sim, int p, int c)
+{
+	int k = batch->numTasks[sim];
+
+	if(k >= BATCH_MAX_TASKS)
+		return -1;
+
+	// Same initial state as addProcess in kernel.cpp
+	batch->p[AT(batch, k, sim)] = p;
+	batch->c[AT(batch, k, sim)] = c;
+	batch->timeLeft[AT(batch, k, sim)] = c;
+	batch->deadline[AT(batch, k, sim)] = p;
+	batch->state[AT(batch, k, sim)] = BATCH_READY;
+	batch->seq[AT(batch, k, sim)] = ++batch->seqCounter[sim];
+	batch->numTasks[sim]++;
+	return 0;
+}
+
+// Returns the task at the head of the given queue, or -1 if it is empty.
+// Queues in prioll.cpp are ordered by period, and a task inserted into
+// a queue goes in front of tasks with an equal period, so among equal
+// periods the most recently inserted task comes first.
+static int queueHead(TBatch *b, int s, int state)
+{
+	int k, best=-1;
+
+	for(k=0; k<b->numTasks[s]; k++)
+	{
+		int i = AT(b, k, s);
+
+		if(b->state[i] != state)
+			continue;
+
+		if(best < 0 || b->p[i] < b->p[AT(b, best, s)] ||
+			(b->p[i] == b->p[AT(b, best, s)] && b->seq[i] > b->seq[AT(b, best, s)]))
+			best = k;
+	}
+
+	return best;
+}
+
+static void moveTo(TBatch *b, int s, int k, int state)
+{
+	int i = AT(b, k, s);
+
+	if(b->state[i] == BATCH_BLOCKED)
+		b->blockedBits[s] &= ~(1 << k);
+
+	if(state == BATCH_BLOCKED)
+		b->blockedBits[s] |= (1 << k);
+
+	b->state[i] = state;
+	b->seq[i] = ++b->seqCounter[s];
+}
+
+// Make task k the running task of simulation s
+static void dispatch(TBatch *b, int s, int k)
+{
+	moveTo(b, s, k, BATCH_RUNNING);
+	b->cur[s] = k;
+	b->curLeft[s] = b->timeLeft[AT(b, k, s)];
+	b->curDeadline[s] = b->deadline[AT(b, k, s)];
+}
+
+// Handles a tick in which something happened in simulation s: a blocked
+// task was released, or the running task used up its time. This mirrors
+// RMSScheduler() after its timeLeft decrement.
+static void batchEvent(TBatch *b, int s)
+{
+	int k;
+
+	// Move released tasks to the ready queue in the order checkReady
+	// would find them in the blocked queue.
+	while(b->relBits[s] != 0)
+	{
+		int next=-1;
+
+		for(k=0; k<b->numTasks[s]; k++)
+		{
+			if(!(b->relBits[s] & (1 << k)))
+				continue;
+
+			if(next < 0 || b->p[AT(b, k, s)] < b->p[AT(b, next, s)] ||
+				(b->p[AT(b, k, s)] == b->p[AT(b, next, s)] && b->seq[AT(b, k, s)] > b->seq[AT(b, next, s)]))
+				next = k;
+		}
+
+		b->relBits[s] &= ~(1 << next);
+		moveTo(b, s, next, BATCH_READY);
+	}
+
+	if(b->cur[s] == -1)
+	{
+		int head = queueHead(b, s, BATCH_READY);
+
+		if(head < 0)
+			return;
+
+		dispatch(b, s, head);
+	}
+
+	int cur = b->cur[s];
+	int ready = queueHead(b, s, BATCH_READY);
+
+	if(b->curLeft[s] == 0)
+	{
+		int i = AT(b, cur, s);
+
+		b->timeLeft[i] = b->c[i];
+		b->deadline[i] += b->p[i];
+		moveTo(b, s, cur, BATCH_BLOCKED);
+
+		int suspended = queueHead(b, s, BATCH_SUSPENDED);
+
+		if(ready < 0 && suspended < 0)
+			b->cur[s] = -1;
+		else if(suspended >= 0)
+		{
+			if(ready >= 0 && b->p[AT(b, ready, s)] < b->p[AT(b, suspended, s)])
+				dispatch(b, s, ready);
+			else
+				dispatch(b, s, suspended);
+		}
+		else
+			dispatch(b, s, ready);
+	}
+	else if(ready >= 0 && b->p[AT(b, ready, s)] < b->p[AT(b, cur, s)])
+	{
+		b->timeLeft[AT(b, cur, s)] = b->curLeft[s];
+		moveTo(b, s, cur, BATCH_SUSPENDED);
+		dispatch(b, s, ready);
+		b->preemptions[s]++;
+	}
+}
+
+static long long batchGCD(long long a, long long b)
+{
+	if(b==0)
+		return a;
+
+	return batchGCD(b, a%b);
+}
+
+// Does what startOS does before starting the timer: dispatch the head of
+// the ready queue and take the LCM of the periods still in the queue.
+static void startSim(TBatch *b, int s)
+{
+	int k, head = queueHead(b, s, BATCH_READY);
+
+	if(head < 0)
+		return;
+
+	dispatch(b, s, head);
+
+	// A few coprime periods are enough to overflow an int, so we work in
+	// 64 bits and stop growing once we are past the cap
+	long long cap = b->horizonCap > 0 ? b->horizonCap : 0x7fffffff;
+	long long lcm = 0;
+
+	for(k=0; k<b->numTasks[s]; k++)
+	{
+		int i = AT(b, k, s);
+
+		if(b->state[i] != BATCH_READY)
+			continue;
+
+		if(lcm == 0)
+			lcm = 1;
+
+		if(lcm <= cap)
+			lcm = lcm / batchGCD(lcm, b->p[i]) * b->p[i];
+	}
+
+	if(NUM_RUNS * lcm > cap)
+	{
+		b->horizon[s] = (int) cap;
+		b->capped[s] = 1;
+	}
+	else
+		b->horizon[s] = (int) (NUM_RUNS * lcm);
+}
+
+#ifdef __AVX2__
+
+// Decrements the running task and release countdowns of the LANES
+// simulations starting at s, and returns a bit mask of the simulations
+// that need batchEvent.
+static int tickBlock(TBatch *b, int s, int timerTick)
+{
+	__m256i tick = _mm256_set1_epi32(timerTick);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi32(1);
+
+	__m256i active = _mm256_cmpgt_epi32(_mm256_loadu_si256((__m256i *) &b->horizon[s]), tick);
+	__m256i running = _mm256_and_si256(active,
+		_mm256_cmpgt_epi32(_mm256_loadu_si256((__m256i *) &b->cur[s]), _mm256_set1_epi32(-1)));
+
+	// The masks are all ones (-1) in lanes where they are true, so adding
+	// a mask decrements those lanes.
+	__m256i curLeft = _mm256_loadu_si256((__m256i *) &b->curLeft[s]);
+
+	if(timerTick != 0)
+		curLeft = _mm256_add_epi32(curLeft, running);
+
+	_mm256_storeu_si256((__m256i *) &b->curLeft[s], curLeft);
+
+	__m256i rel = zero;
+	int k;
+
+	for(k=0; k<BATCH_MAX_TASKS; k++)
+	{
+		__m256i *cd = (__m256i *) &b->countdown[AT(b, k, s)];
+		__m256i p = _mm256_loadu_si256((__m256i *) &b->p[AT(b, k, s)]);
+		__m256i count = _mm256_loadu_si256(cd);
+		__m256i due = _mm256_and_si256(active, _mm256_cmpeq_epi32(count, zero));
+
+		count = _mm256_blendv_epi8(_mm256_sub_epi32(count, one), _mm256_sub_epi32(p, one), due);
+		_mm256_storeu_si256(cd, count);
+		rel = _mm256_or_si256(rel, _mm256_and_si256(due, _mm256_set1_epi32(1 << k)));
+	}
+
+	rel = _mm256_and_si256(rel, _mm256_loadu_si256((__m256i *) &b->blockedBits[s]));
+	_mm256_storeu_si256((__m256i *) &b->relBits[s], rel);
+
+	__m256i done = _mm256_and_si256(running, _mm256_cmpeq_epi32(curLeft, zero));
+	__m256i event = _mm256_or_si256(done, _mm256_andnot_si256(_mm256_cmpeq_epi32(rel, zero), active));
+
+	return _mm256_movemask_ps(_mm256_castsi256_ps(event));
+}
+
+// Counts deadline misses and idle ticks once the scheduling decisions
+// for this tick have been made.
+static void accountBlock(TBatch *b, int s, int timerTick)
+{
+	__m256i tick = _mm256_set1_epi32(timerTick);
+	__m256i active = _mm256_cmpgt_epi32(_mm256_loadu_si256((__m256i *) &b->horizon[s]), tick);
+	__m256i idle = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *) &b->cur[s]), _mm256_set1_epi32(-1));
+	__m256i running = _mm256_andnot_si256(idle, active);
+
+	idle = _mm256_and_si256(idle, active);
+
+	// timerTick >= deadline is the same as !(deadline > timerTick)
+	__m256i miss = _mm256_andnot_si256(
+		_mm256_cmpgt_epi32(_mm256_loadu_si256((__m256i *) &b->curDeadline[s]), tick), running);
+
+	__m256i *missTicks = (__m256i *) &b->missTicks[s];
+	__m256i *idleTicks = (__m256i *) &b->idleTicks[s];
+
+	_mm256_storeu_si256(missTicks, _mm256_sub_epi32(_mm256_loadu_si256(missTicks), miss));
+	_mm256_storeu_si256(idleTicks, _mm256_sub_epi32(_mm256_loadu_si256(idleTicks), idle));
+}
+
+#else
+
+static int tickBlock(TBatch *b, int s, int timerTick)
+{
+	int lane, k, mask=0;
+
+	for(lane=0; lane<LANES; lane++)
+	{
+		int sim = s + lane;
+
+		if(timerTick >= b->horizon[sim])
+			continue;
+
+		if(timerTick != 0 && b->cur[sim] >= 0)
+			--b->curLeft[sim];
+
+		int rel = 0;
+
+		for(k=0; k<BATCH_MAX_TASKS; k++)
+		{
+			int i = AT(b, k, sim);
+
+			if(b->countdown[i] == 0)
+			{
+				b->countdown[i] = b->p[i] - 1;
+				rel |= (1 << k);
+			}
+			else
+				--b->countdown[i];
+		}
+
+		b->relBits[sim] = rel & b->blockedBits[sim];
+
+		if(b->relBits[sim] != 0 || (b->cur[sim] >= 0 && b->curLeft[sim] == 0))
+			mask |= (1 << lane);
+	}
+
+	return mask;
+}
+
+static void accountBlock(TBatch *b, int s, int timerTick)
+{
+	int lane;
+
+	for(lane=0; lane<LANES; lane++)
+	{
+		int sim = s + lane;
+
+		if(timerTick >= b->horizon[sim])
+			continue;
+
+		if(b->cur[sim] == -1)
+			b->idleTicks[sim]++;
+		else if(timerTick >= b->curDeadline[sim])
+			b->missTicks[sim]++;
+	}
+}
+
+#endif
+
+void runBatch(TBatch *batch)
+{
+	int s, timerTick, maxHorizon=0;
+
+	for(s=0; s<batch->numSims; s++)
+	{
+		startSim(batch, s);
+
+		if(batch->horizon[s] > maxHorizon)
+			maxHorizon = batch->horizon[s];
+	}
+
+	// All simulations advance one tick at a time together. Once a
+	// simulation reaches its own horizon its lanes are simply masked off.
+	for(timerTick=0; timerTick<maxHorizon; timerTick++)
+	{
+		for(s=0; s<batch->stride; s+=LANES)
+		{
+			int mask = tickBlock(batch, s, timerTick);
+
+			while(mask != 0)
+			{
+				int lane = __builtin_ctz(mask);
+
+				batchEvent(batch, s + lane);
+				mask &= mask - 1;
+			}
+
+			accountBlock(batch, s, timerTick);
+		}
+	}
+}
+
+int batchSchedulable(TBatch *batch, int sim)
+{
+	return batch->missTicks[sim] == 0;
+}
+
+void freeBatch(TBatch *batch)
+{
+	free(batch->p);
+	free(batch->c);
+	free(batch->countdown);
+	free(batch->timeLeft);
+	free(batch->deadline);
+	free(batch->state);
+	free(batch->seq);
+	free(batch->numTasks);
+	free(batch->cur);
+	free(batch->curLeft);
+	free(batch->curDeadline);
+	free(batch->horizon);
+	free(batch->capped);
+	free(batch->blockedBits);
+	free(batch->relBits);
+	free(batch->seqCounter);
+	free(batch->missTicks);
+	free(batch->idleTicks);
+	free(batch->preemptions);
+}
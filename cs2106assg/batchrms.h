@@ -0,0 +1,75 @@
+#ifndef __BATCHRMS_H__
+#define __BATCHRMS_H__
+
+#include "kernel.h"
+
+// This file implements a batch RMS simulator that runs many small,
+// independent task sets side by side. Every simulation follows exactly
+// the same rules as RMSScheduler() in kernel.cpp, but the per-tick
+// bookkeeping for all simulations is done together using AVX2 (if the
+// compiler has it enabled with -mavx2) or a plain loop otherwise.
+
+// Maximum number of tasks in one simulation
+#define BATCH_MAX_TASKS	NUM_PROCESSES
+
+// Task states
+enum
+{
+	BATCH_BLOCKED=0,
+	BATCH_READY,
+	BATCH_SUSPENDED,
+	BATCH_RUNNING
+};
+
+// All per-task arrays are laid out task-major, i.e. the data for task k
+// of simulation s is at [k * stride + s], so that the same task of
+// neighbouring simulations sits in consecutive memory.
+typedef struct
+{
+	int numSims;
+	int stride;
+	int horizonCap;		// Simulations stop after this many ticks, 0 for no limit
+
+	// Per task data
+	int *p, *c;
+	int *countdown;		// Ticks until the next release
+	int *timeLeft;
+	int *deadline;
+	int *state;
+	int *seq;			// Order of insertion into the task's current queue
+
+	// Per simulation data
+	int *numTasks;
+	int *cur;			// Currently running task or -1
+	int *curLeft;		// timeLeft of the running task
+	int *curDeadline;	// deadline of the running task
+	int *horizon;		// Number of ticks to simulate
+	int *blockedBits;	// Bit k is set if task k is blocked
+	int *relBits;		// Scratch: blocked tasks released this tick
+	int *seqCounter;
+
+	// Results per simulation
+	int *missTicks;		// Ticks spent running past a deadline
+	int *idleTicks;
+	int *preemptions;
+	int *capped;		// 1 if the simulation stopped at horizonCap
+} TBatch;
+
+// Initializes a batch of numSims empty simulations
+void initBatch(TBatch *batch, int numSims);
+
+// Adds a task with period p and execution time c to simulation sim.
+// Returns -1 if the simulation is full, 0 otherwise.
+int batchAddProcess(TBatch *batch, int sim, int p, int c);
+
+// Runs every simulation in the batch for NUM_RUNS hyperperiods, or for
+// horizonCap ticks if that is shorter
+void runBatch(TBatch *batch);
+
+// Returns 1 if simulation sim never ran a task past its deadline
+int batchSchedulable(TBatch *batch, int sim);
+
+// Frees all memory used by the batch
+void freeBatch(TBatch *batch);
+
+#endif
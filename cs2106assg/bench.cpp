@@ -0,0 +1,439 @@
+// Micro-benchmarks for the scheduler data structures.
+//
+// Build with:
+//	g++ -O2 -o bench bench.cpp kernel.cpp llist.cpp prioll.cpp
+//
+// Output is one CSV line per benchmark and queue size:
+//	benchmark,size,ops,ns_per_op,allocs_per_op
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "llist.h"
+#include "prioll.h"
+#include "tqueue.h"
+#include "kernel.h"
+
+#if SCHEDULER_TYPE == 0
+// Defined in kernel.cpp
+extern TFifo<int> *activeList;
+int findNextPrio(int currPrio);
+#endif
+
+// Smallest and largest queue sizes, stepping by a factor of 10
+#define MIN_SIZE	10
+#define MAX_SIZE	1000000
+
+// Roughly how many list nodes each benchmark may visit, so that the
+// O(n) operations do not take forever at large sizes.
+#define WORK_BUDGET	20000000L
+#define MIN_OPS		10
+#define MAX_OPS		100000
+
+// Count allocations by intercepting malloc, which llist.cpp and
+// prioll.cpp use for their nodes, and operator new uses for the arrays
+// in tqueue.h.
+static long allocCount = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+
+extern "C" void *malloc(size_t size) noexcept
+{
+	allocCount++;
+	return __libc_malloc(size);
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Number of operations to time for an operation that costs "cost" node
+// visits each.
+static long numOps(long cost)
+{
+	long ops = WORK_BUDGET / cost;
+
+	if(ops < MIN_OPS)
+		ops = MIN_OPS;
+
+	if(ops > MAX_OPS)
+		ops = MAX_OPS;
+
+	return ops;
+}
+
+static void report(const char *name, long size, long ops, double ns, long allocs)
+{
+	printf("%s,%ld,%ld,%.1f,%.2f\n", name, size, ops, ns / ops, (double) allocs / ops);
+}
+
+// Builds a FIFO of n nodes directly. Calling insert n times would take
+// O(n^2) because insert walks to the tail every time.
+static TNode *buildList(long n)
+{
+	TNode *head = NULL, *tail = NULL;
+	long i;
+
+	for(i=0; i<n; i++)
+	{
+		TNode *node = (TNode *) malloc(sizeof(TNode));
+
+		node->procNum = i;
+		node->quantum = QUANTUM_MIN;
+		node->next = NULL;
+		node->prev = tail;
+
+		if(tail == NULL)
+			head = node;
+		else
+			tail->next = node;
+
+		tail = node;
+	}
+
+	return head;
+}
+
+// Builds a priority list of n nodes with priorities 2, 2+step, 2+2*step, ...
+// and the given period.
+static TPrioNode *buildPrioList(long n, int step, int period)
+{
+	TPrioNode *head = NULL, *tail = NULL;
+	long i;
+
+	for(i=0; i<n; i++)
+	{
+		TPrioNode *node = (TPrioNode *) malloc(sizeof(TPrioNode));
+
+		node->procNum = i;
+		node->prio = (int) (i * step) + 2;
+		node->p = period;
+		node->next = NULL;
+		node->prev = tail;
+
+		if(tail == NULL)
+			head = node;
+		else
+			tail->next = node;
+
+		tail = node;
+	}
+
+	return head;
+}
+
+static void benchInsert(long n)
+{
+	TNode *head = buildList(n);
+	long i, ops = numOps(n);
+	double ns = 0;
+	long allocs = 0;
+
+	// Insert in small batches and take the items off the front again so the
+	// list stays close to n items.
+	long batch = n / 10 > 0 ? n / 10 : 1;
+
+	for(i=0; i<ops; )
+	{
+		long j, k = (ops - i < batch) ? ops - i : batch;
+		long a = allocCount;
+		double start = now();
+
+		for(j=0; j<k; j++)
+			insert(&head, j, QUANTUM_MIN);
+
+		ns += now() - start;
+		allocs += allocCount - a;
+
+		for(j=0; j<k; j++)
+			remove(&head);
+
+		i += k;
+	}
+
+	report("insert", n, ops, ns, allocs);
+	destroy(&head);
+}
+
+static void benchRemove(long n)
+{
+	long i, ops = numOps(1);
+	TNode *head = buildList(n + ops);
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		remove(&head);
+
+	report("remove", n, ops, now() - start, allocCount - a);
+	destroy(&head);
+}
+
+static void benchTotalQuantum(long n)
+{
+	TNode *head = buildList(n);
+	long i, ops = numOps(n);
+	volatile int sink = 0;
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		sink += totalQuantum(head);
+
+	report("totalQuantum", n, ops, now() - start, allocCount - a);
+	destroy(&head);
+}
+
+static void benchPrioInsertNode(long n)
+{
+	TPrioNode *head = buildPrioList(n, 2, 4);
+	long i, ops = numOps(n / 2 + 1);
+	long batch = n / 10 > 0 ? n / 10 : 1;
+	TPrioNode *nodes = (TPrioNode *) calloc(batch, sizeof(TPrioNode));
+	double ns = 0;
+	long allocs = 0;
+
+	srand(2106);
+
+	// Insert a batch at random positions, then unlink them again so the
+	// list stays close to n items.
+	for(i=0; i<ops; )
+	{
+		long j, k = (ops - i < batch) ? ops - i : batch;
+
+		for(j=0; j<k; j++)
+		{
+			nodes[j].prev = NULL;
+			nodes[j].next = NULL;
+			nodes[j].prio = (int) (rand() % (2 * n)) + 1;
+		}
+
+		long a = allocCount;
+		double start = now();
+
+		for(j=0; j<k; j++)
+			prioInsertNode(&head, &nodes[j]);
+
+		ns += now() - start;
+		allocs += allocCount - a;
+
+		for(j=0; j<k; j++)
+			prioRemoveNode(&head, &nodes[j]);
+
+		i += k;
+	}
+
+	report("prioInsertNode", n, ops, ns, allocs);
+	free(nodes);
+	prioDestroy(&head);
+}
+
+static void benchPrioRemove(long n)
+{
+	long i, ops = numOps(1);
+	TPrioNode *head = buildPrioList(n + ops, 1, 4);
+	TPrioNode **removed = (TPrioNode **) calloc(ops, sizeof(TPrioNode *));
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		removed[i] = prioRemove(&head);
+
+	report("prioRemove", n, ops, now() - start, allocCount - a);
+
+	for(i=0; i<ops; i++)
+		free(removed[i]);
+
+	free(removed);
+	prioDestroy(&head);
+}
+
+static void benchCheckReady(long n)
+{
+	// Priorities are all >= 2 and the tick is 1, so nothing is ever ready
+	// and checkReady has to scan the whole list.
+	TPrioNode *head = buildPrioList(n, 1, 4);
+	long i, ops = numOps(n);
+	volatile long sink = 0;
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		sink += (long) checkReady(head, 1);
+
+	report("checkReady", n, ops, now() - start, allocCount - a);
+	prioDestroy(&head);
+}
+
+static void benchPrioLCM(long n)
+{
+	TPrioNode *head = buildPrioList(n, 1, 4);
+	TPrioNode *trav;
+	long i, ops = numOps(n);
+	volatile int sink = 0;
+
+	// Cycle through a few periods so the LCM stays small
+	for(trav=head, i=0; trav!=NULL; trav=trav->next, i++)
+		trav->p = (int) (i % 3) + 2;
+
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		sink += prioLCM(head);
+
+	report("prioLCM", n, ops, now() - start, allocCount - a);
+	prioDestroy(&head);
+}
+
+static void benchFifo(long n)
+{
+	TFifo<int> fifo;
+	long i, ops = numOps(1);
+
+	for(i=0; i<n; i++)
+		fifo.push((int) i);
+
+	long a = allocCount;
+	double start = now();
+
+	// One push and one pop per op, so the queue stays at n items
+	for(i=0; i<ops; i++)
+		fifo.push(fifo.pop());
+
+	report("TFifo push+pop", n, ops, now() - start, allocCount - a);
+}
+
+static void benchPrioQueuePush(long n)
+{
+	TPrioQueue<int, int> queue;
+	long i, ops = numOps(n / 2 + 1);
+	long batch = n / 10 > 0 ? n / 10 : 1;
+	double ns = 0;
+	long allocs = 0;
+
+	for(i=0; i<n; i++)
+		queue.push((int) (i * 2) + 2, (int) i);
+
+	srand(2106);
+
+	// Same pattern as benchPrioInsertNode
+	for(i=0; i<ops; )
+	{
+		long j, k = (ops - i < batch) ? ops - i : batch;
+		long a = allocCount;
+		double start = now();
+
+		for(j=0; j<k; j++)
+			queue.push((int) (rand() % (2 * n)) + 1, (int) j);
+
+		ns += now() - start;
+		allocs += allocCount - a;
+
+		for(j=0; j<k; j++)
+			queue.pop();
+
+		i += k;
+	}
+
+	report("TPrioQueue push", n, ops, ns, allocs);
+}
+
+static void benchPrioQueuePop(long n)
+{
+	TPrioQueue<int, int> queue;
+	long i, ops = numOps(1);
+	volatile int sink = 0;
+
+	for(i=0; i<n + ops; i++)
+		queue.push((int) (n + ops - i) + 2, (int) i);
+
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		sink += queue.pop();
+
+	report("TPrioQueue pop", n, ops, now() - start, allocCount - a);
+}
+
+static void benchHeapUpdate(long n)
+{
+	TIndexedHeap<int> heap((int) n);
+	long i, ops = numOps(1);
+
+	for(i=0; i<n; i++)
+		heap.push((int) i, (int) i);
+
+	srand(2106);
+
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		heap.update(rand() % n, rand() % (2 * n));
+
+	report("TIndexedHeap update", n, ops, now() - start, allocCount - a);
+}
+
+#if SCHEDULER_TYPE == 0
+// For findNextPrio the size is the first non-empty priority level,
+// which is how far it has to scan. PRIO_LEVELS means every level is empty.
+static void benchFindNextPrio(int level)
+{
+	long i, ops = MAX_OPS;
+	volatile int sink = 0;
+
+	initOS();
+
+	if(level < PRIO_LEVELS)
+		activeList[level].push(0);
+
+	long a = allocCount;
+	double start = now();
+
+	for(i=0; i<ops; i++)
+		sink += findNextPrio(0);
+
+	report("findNextPrio", level, ops, now() - start, allocCount - a);
+
+	if(level < PRIO_LEVELS)
+		activeList[level].clear();
+}
+#endif
+
+int main()
+{
+	long n;
+
+	printf("benchmark,size,ops,ns_per_op,allocs_per_op\n");
+
+	for(n=MIN_SIZE; n<=MAX_SIZE; n*=10)
+	{
+		benchInsert(n);
+		benchRemove(n);
+		benchTotalQuantum(n);
+		benchPrioInsertNode(n);
+		benchPrioRemove(n);
+		benchCheckReady(n);
+		benchPrioLCM(n);
+		benchFifo(n);
+		benchPrioQueuePush(n);
+		benchPrioQueuePop(n);
+		benchHeapUpdate(n);
+	}
+
+#if SCHEDULER_TYPE == 0
+	int levels[] = {0, 10, 70, PRIO_LEVELS-1, PRIO_LEVELS};
+	unsigned j;
+
+	for(j=0; j<sizeof(levels)/sizeof(levels[0]); j++)
+		benchFindNextPrio(levels[j]);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "tqueue.h"
+#include "gang.h"
+
+/* Task and group tables */
+
+typedef struct
+{
+	int group;
+	unsigned affinity;
+	int cpu;		// CPU the task is on, or -1
+} TGangTask;
+
+typedef struct
+{
+	int numTasks;
+	int tasks[NUM_CPUS];
+	int workLeft;
+	int running;
+	int finishTime;
+	int waitTicks;	// Ticks spent waiting while not finished
+} TGroup;
+
+TGangTask gangTasks[GANG_MAX_TASKS];
+TGroup groups[GANG_MAX_GROUPS];
+
+int numGangTasks, numGroups;
+
+// Task running on each CPU, or -1
+int cpuTask[NUM_CPUS];
+
+// Groups waiting for CPUs, in round robin order
+TFifo<int> gangQueue;
+
+int gangTick;
+
+// Statistics
+int cpuBusy[NUM_CPUS];
+int idleTicks;		// CPU-ticks with nothing left to run
+int gangIdleTicks;	// CPU-ticks left idle while a group was waiting
+int numSlots;
+
+void initGang()
+{
+	int i;
+
+	numGangTasks = 0;
+	numGroups = 0;
+	gangQueue.clear();
+	gangTick = 0;
+	idleTicks = 0;
+	gangIdleTicks = 0;
+	numSlots = 0;
+
+	for(i=0; i<NUM_CPUS; i++)
+	{
+		cpuTask[i] = -1;
+		cpuBusy[i] = 0;
+	}
+}
+
+int addGroup(int work)
+{
+	if(numGroups >= GANG_MAX_GROUPS)
+		return -1;
+
+	groups[numGroups].numTasks = 0;
+	groups[numGroups].workLeft = work;
+	groups[numGroups].running = 0;
+	groups[numGroups].finishTime = -1;
+	groups[numGroups].waitTicks = 0;
+
+	gangQueue.push(numGroups);
+	return numGroups++;
+}
+
+int addGangTask(int group, unsigned affinity)
+{
+	if(numGangTasks >= GANG_MAX_TASKS || group < 0 || group >= numGroups)
+		return -1;
+
+	// A group can never have more tasks than there are CPUs
+	if(groups[group].numTasks >= NUM_CPUS)
+		return -1;
+
+	gangTasks[numGangTasks].group = group;
+	gangTasks[numGangTasks].affinity = affinity & ALL_CPUS;
+	gangTasks[numGangTasks].cpu = -1;
+
+	groups[group].tasks[groups[group].numTasks++] = numGangTasks;
+	return numGangTasks++;
+}
+
+// Tries to give task t a CPU from "allowed", moving already placed tasks
+// of the same group to other CPUs if needed (augmenting path matching).
+static int placeTask(int t, unsigned allowed, int *owner, unsigned *visited)
+{
+	int cpu;
+
+	for(cpu=0; cpu<NUM_CPUS; cpu++)
+	{
+		unsigned bit = 1u << cpu;
+
+		if(!(gangTasks[t].affinity & allowed & bit) || (*visited & bit))
+			continue;
+
+		*visited |= bit;
+
+		if(owner[cpu] < 0 || placeTask(owner[cpu], allowed, owner, visited))
+		{
+			owner[cpu] = t;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Places every task of group g onto the free CPUs, honouring affinity.
+// Either the whole group is placed and 1 is returned, or nothing changes
+// and 0 is returned.
+static int placeGroup(int g)
+{
+	int owner[NUM_CPUS];
+	unsigned freeCPUs = 0;
+	int i;
+
+	for(i=0; i<NUM_CPUS; i++)
+	{
+		owner[i] = -1;
+
+		if(cpuTask[i] < 0)
+			freeCPUs |= (1u << i);
+	}
+
+	for(i=0; i<groups[g].numTasks; i++)
+	{
+		unsigned visited = 0;
+
+		if(!placeTask(groups[g].tasks[i], freeCPUs, owner, &visited))
+			return 0;
+	}
+
+	for(i=0; i<NUM_CPUS; i++)
+		if(owner[i] >= 0)
+		{
+			cpuTask[i] = owner[i];
+			gangTasks[owner[i]].cpu = i;
+		}
+
+	groups[g].running = 1;
+	return 1;
+}
+
+// Goes through the waiting groups once in round robin order and starts
+// every group that fits on the CPUs that are still free.
+static void fillCPUs()
+{
+	int i, n = gangQueue.size();
+
+	for(i=0; i<n; i++)
+	{
+		int g = gangQueue.pop();
+
+		// Groups without tasks or work are dropped from the queue
+		if(groups[g].workLeft <= 0)
+			continue;
+
+		if(!placeGroup(g))
+			gangQueue.push(g);
+	}
+}
+
+static void stopGroup(int g)
+{
+	int i;
+
+	for(i=0; i<groups[g].numTasks; i++)
+	{
+		int t = groups[g].tasks[i];
+
+		cpuTask[gangTasks[t].cpu] = -1;
+		gangTasks[t].cpu = -1;
+	}
+
+	groups[g].running = 0;
+}
+
+// Ends the current time slice. Groups that are still running go to the
+// back of the queue, and the CPUs are handed out again from the front.
+static void endSlot()
+{
+	int g;
+
+	for(g=0; g<numGroups; g++)
+		if(groups[g].running)
+		{
+			stopGroup(g);
+			gangQueue.push(g);
+		}
+
+	fillCPUs();
+	numSlots++;
+}
+
+static void printCPUs()
+{
+	int i;
+
+	printf("Time: %d", gangTick);
+
+	for(i=0; i<NUM_CPUS; i++)
+	{
+		int t = cpuTask[i];
+
+		if(t < 0)
+			printf(" CPU%d: ---", i);
+		else
+			printf(" CPU%d: G%d.T%d", i, gangTasks[t].group+1, t+1);
+	}
+
+	printf("\n");
+}
+
+static void gangISR()
+{
+	int i, g;
+
+	// Count idle CPUs, blaming the gang constraints if a group was waiting
+	for(i=0; i<NUM_CPUS; i++)
+	{
+		if(cpuTask[i] >= 0)
+			cpuBusy[i]++;
+		else if(!gangQueue.empty())
+			gangIdleTicks++;
+		else
+			idleTicks++;
+	}
+
+	for(g=0; g<numGroups; g++)
+		if(!groups[g].running && groups[g].workLeft > 0)
+			groups[g].waitTicks++;
+
+	gangTick++;
+
+	// Run the groups for one tick, and free the CPUs of finished groups
+	int finished = 0;
+
+	for(g=0; g<numGroups; g++)
+		if(groups[g].running && --groups[g].workLeft == 0)
+		{
+			stopGroup(g);
+			groups[g].finishTime = gangTick;
+			finished = 1;
+		}
+
+	if(gangTick % GANG_QUANTUM == 0)
+		endSlot();
+	else if(finished)
+		fillCPUs();
+	else
+		return;
+
+	printCPUs();
+}
+
+static void printGangStats()
+{
+	int i, g;
+	int total = gangTick * NUM_CPUS;
+
+	if(gangTick == 0)
+		return;
+
+	printf("\n******* GANG STATISTICS *******\n\n");
+	printf("Ticks: %d Slots: %d\n", gangTick, numSlots);
+
+	for(i=0; i<NUM_CPUS; i++)
+		printf("CPU%d busy: %d (%.1f%%)\n", i, cpuBusy[i], 100.0 * cpuBusy[i] / gangTick);
+
+	printf("Idle CPU-ticks: %d, of which %d due to gang/affinity constraints (%.1f%% fragmentation)\n",
+		idleTicks + gangIdleTicks, gangIdleTicks, 100.0 * gangIdleTicks / total);
+
+	for(g=0; g<numGroups; g++)
+		printf("G%d: %d tasks finished at %d, waited %d ticks\n", g+1, groups[g].numTasks,
+			groups[g].finishTime, groups[g].waitTicks);
+}
+
+void startGang()
+{
+	int g;
+
+	// Groups with no tasks have nothing to run
+	for(g=0; g<numGroups; g++)
+		if(groups[g].numTasks == 0)
+			groups[g].workLeft = 0;
+
+	fillCPUs();
+	printCPUs();
+
+	while(1)
+	{
+		int done = 1;
+
+		for(g=0; g<numGroups; g++)
+			if(groups[g].workLeft > 0)
+				done = 0;
+
+		// A waiting group that cannot fit even on an empty machine would
+		// wait forever.
+		int cpu, stuck = !gangQueue.empty();
+
+		for(cpu=0; cpu<NUM_CPUS; cpu++)
+			if(cpuTask[cpu] >= 0)
+				stuck = 0;
+
+		if(done || stuck)
+		{
+			if(stuck)
+				printf("ERROR: Group %d cannot be placed on %d CPUs!\n", gangQueue.front()+1, NUM_CPUS);
+
+			break;
+		}
+
+		gangISR();
+#if TICK_USEC > 0
+		usleep(TICK_USEC);
+#endif
+	}
+
+	gangQueue.clear();
+	printGangStats();
+}
@@ -0,0 +1,33 @@
+#ifndef __GANG_H__
+#define __GANG_H__
+
+#include "kernel.h"
+
+// This file implements a multi-CPU simulator with gang scheduling. Tasks
+// belong to groups, and all tasks of a group are always run together on
+// different CPUs, or not at all. Each task may also be restricted to a
+// set of CPUs by an affinity mask.
+
+#define GANG_MAX_GROUPS		16
+#define GANG_MAX_TASKS		32
+
+// Length of a gang time slice in timer ticks
+#define GANG_QUANTUM		10
+
+// Affinity mask that allows every CPU
+#define ALL_CPUS			((1u << NUM_CPUS) - 1)
+
+void initGang();
+
+// Adds a group that needs "work" timer ticks to finish.
+// Returns the group number, or -1 if there are too many groups.
+int addGroup(int work);
+
+// Adds a task to a group. Bit i of affinity is set if the task may run on
+// CPU i. Returns the task number, or -1 if there are too many tasks.
+int addGangTask(int group, unsigned affinity);
+
+// Runs all groups to completion and prints the schedule and statistics
+void startGang();
+
+#endif
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include "gang.h"
+
+int main()
+{
+	initGang();
+
+	// A 3 thread job, a 2 thread job with one thread pinned to CPU 0,
+	// and two single threaded jobs.
+	int g1 = addGroup(30);
+	addGangTask(g1, ALL_CPUS);
+	addGangTask(g1, ALL_CPUS);
+	addGangTask(g1, ALL_CPUS);
+
+	int g2 = addGroup(25);
+	addGangTask(g2, 1 << 0);
+	addGangTask(g2, ALL_CPUS);
+
+	int g3 = addGroup(15);
+	addGangTask(g3, ALL_CPUS);
+
+	int g4 = addGroup(20);
+	addGangTask(g4, 1 << 0);
+
+	startGang();
+}
@@ -2,10 +2,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <algorithm>
-#include "llist.h"
-#include "prioll.h"
+#include "tqueue.h"
 #include "kernel.h"
 
+#if EXPORT_STATS == 1
+#include <time.h>
+#include "schedstats.h"
+#endif
+
 /*
 
 	STUDENT 1 NUMBER: A0168721B
@@ -28,6 +32,15 @@ int procCount;
 int timerTick=0;
 int currProcess, currPrio;
 
+// Timer tick at which the simulation stops
+int endTick=0;
+
+// Last process printed by timerISR
+int prevProcess=-1;
+
+// Statistics. deadlineMisses counts jobs, not the ticks they ran late.
+long listSwaps, preemptions, deadlineMisses;
+
 #if SCHEDULER_TYPE == 0
 
 /* Process Control Block for LINUX scheduler*/
@@ -48,8 +61,13 @@ typedef struct tcb
 	int procNum;
 	int timeLeft;
 	int deadline;
-	int c;
+	int c;			// LO criticality budget
 	int p;
+	int cHi;		// HI criticality budget
+	int crit;		// LO_CRIT or HI_CRIT
+	int demand;		// Execution time of the current job
+	int jobNum;		// Number of jobs completed or dropped
+	int missedDeadline;	// Deadline last counted in deadlineMisses, so each job counts once
 } TTCB;
 
 #endif
@@ -59,24 +77,27 @@ TTCB processes[NUM_PROCESSES];
 
 #if SCHEDULER_TYPE == 0
 
-// Lists of processes according to priority levels.
-TNode *queueList1[PRIO_LEVELS];
-TNode *queueList2[PRIO_LEVELS];
+// Lists of process numbers according to priority levels.
+TFifo<int> queueList1[PRIO_LEVELS];
+TFifo<int> queueList2[PRIO_LEVELS];
 
 // Active list and expired list pointers
-TNode **activeList = queueList1;
-TNode **expiredList = queueList2;
+TFifo<int> *activeList = queueList1;
+TFifo<int> *expiredList = queueList2;
 
 #elif SCHEDULER_TYPE == 1
 
-// Ready queue and blocked queue
-TPrioNode *readyQueue, *blockedQueue;
+// Ready queue and blocked queue of process numbers, ordered by period
+TPrioQueue<int, int> readyQueue, blockedQueue;
 
 // This stores the data for pre-empted processes.
-TPrioNode *suspended; // Suspended process due to pre-emption
+TPrioQueue<int, int> suspended; // Suspended process due to pre-emption
 
-// Currently running process
-TPrioNode *currProcessNode; // Current process
+// Mixed criticality mode. In HI_CRIT mode LO_CRIT processes are dropped.
+int critMode;
+int numHiProcs;
+int modeSwitches;
+int loJobs, loJobsDropped;
 #endif
 
 
@@ -88,7 +109,7 @@ int findNextPrio(int currPrio)
 	int i;
 
 	for(i=0; i<PRIO_LEVELS; i++)
-		if(activeList[i] != NULL)
+		if(!activeList[i].empty())
 			return i;
 
 	return -1; 
@@ -100,13 +121,14 @@ int linuxScheduler()
 		--processes[currProcess].timeLeft;
 	if(processes[currProcess].timeLeft == 0) {
 		processes[currProcess].timeLeft = processes[currProcess].quantum;
-		insert(&expiredList[processes[currProcess].prio], currProcess, processes[currProcess].quantum);
+		expiredList[processes[currProcess].prio].push(currProcess);
 		int nextProcNo = findNextPrio(currPrio);
 		if(nextProcNo < 0) {
 			printf("\n******* SWAPPED LIST *******\n\n");
+			listSwaps++;
 			std::swap(activeList, expiredList);
 		}
-		return remove(&activeList[findNextPrio(currPrio)]);
+		return activeList[findNextPrio(currPrio)].pop();
 	}
 	
 	return currProcess;
@@ -129,51 +151,179 @@ int linuxScheduler()
 }
 #elif SCHEDULER_TYPE == 1
 
+static int gcd(int a, int b)
+{
+	if(b==0)
+		return a;
+
+	return gcd(b, a%b);
+}
+
+// Find the LCM of all the periods in a queue
+int periodLCM(TPrioQueue<int, int> &queue)
+{
+	if(queue.empty())
+		return 0;
+
+	int res=1, i;
+
+	for(i=0; i<queue.size(); i++)
+		res = res * queue.keyAt(i)/gcd(res, queue.keyAt(i));
+
+	return res;
+}
+
+// Find the earliest time after timerTick at which a process in the queue
+// is released. Returns -1 if the queue is empty.
+int nextRelease(TPrioQueue<int, int> &queue, int timerTick)
+{
+	int next = -1, i;
+
+	for(i=0; i<queue.size(); i++)
+	{
+		// Next multiple of the period strictly after timerTick
+		int release = (timerTick / queue.keyAt(i) + 1) * queue.keyAt(i);
+
+		if(next < 0 || release < next)
+			next = release;
+	}
+
+	return next;
+}
+
+// Execution time of the next job of process i
+int jobDemand(int i)
+{
+	if(processes[i].crit == HI_CRIT && processes[i].jobNum % MC_OVERRUN_PERIOD == MC_OVERRUN_PERIOD - 1)
+		return processes[i].cHi;
+
+	return processes[i].c;
+}
+
+// Sets process i up for its next job
+void nextJob(int i)
+{
+	processes[i].jobNum++;
+	processes[i].demand = jobDemand(i);
+	processes[i].timeLeft = processes[i].demand;
+}
+
+// Skips the current job of a LO_CRIT process i
+void dropJob(int i)
+{
+	processes[i].deadline += processes[i].p;
+	nextJob(i);
+	loJobsDropped++;
+}
+
+// Drops every LO_CRIT job in the given queue and blocks the process until
+// its next release.
+void dropLoJobs(TPrioQueue<int, int> &queue)
+{
+	int i = 0;
+
+	while(i < queue.size())
+	{
+		int proc = queue.at(i);
+
+		if(processes[proc].crit == LO_CRIT)
+		{
+			queue.removeAt(i);
+			dropJob(proc);
+			blockedQueue.push(processes[proc].p, proc);
+		}
+		else
+			i++;
+	}
+}
+
+// A HI_CRIT job has used up its LO budget
+void enterHiMode()
+{
+	printf("\n****** HI-CRITICALITY MODE ******\n\n");
+	critMode = HI_CRIT;
+	modeSwitches++;
+	dropLoJobs(readyQueue);
+	dropLoJobs(suspended);
+}
+
+// The CPU is idle, so no HI_CRIT job can still be overrunning
+void leaveHiMode()
+{
+	if(critMode == HI_CRIT)
+	{
+		printf("\n****** LO-CRITICALITY MODE ******\n\n");
+		critMode = LO_CRIT;
+	}
+}
+
 int RMSScheduler()
 {	
-	if(timerTick != 0)
+	if(timerTick != 0 && currProcess >= 0)
 		--processes[currProcess].timeLeft;
-	TPrioNode *node = checkReady(blockedQueue, timerTick);
-	while(node != NULL){
-		prioRemoveNode(&blockedQueue, node);
-		prioInsertNode(&readyQueue, node);
-		node = checkReady(blockedQueue, timerTick);
+
+	if(critMode == LO_CRIT && currProcess >= 0 && processes[currProcess].crit == HI_CRIT &&
+		processes[currProcess].timeLeft > 0 &&
+		processes[currProcess].demand - processes[currProcess].timeLeft >= processes[currProcess].c)
+		enterHiMode();
+
+	// Released LO_CRIT jobs are dropped in HI_CRIT mode. We park them in
+	// a separate queue so they do not go back into blockedQueue while we
+	// are still scanning it.
+	TPrioQueue<int, int> dropped;
+	int i = 0;
+	while(i < blockedQueue.size()){
+		if(timerTick % blockedQueue.keyAt(i) != 0) {
+			i++;
+			continue;
+		}
+
+		int proc = blockedQueue.at(i);
+		blockedQueue.removeAt(i);
+
+		if(processes[proc].crit == LO_CRIT)
+			loJobs++;
+
+		if(critMode == HI_CRIT && processes[proc].crit == LO_CRIT) {
+			dropJob(proc);
+			dropped.push(processes[proc].p, proc);
+		} else
+			readyQueue.push(processes[proc].p, proc);
+	}
+	while(!dropped.empty()) {
+		int proc = dropped.pop();
+		blockedQueue.push(processes[proc].p, proc);
 	}
+
 	if(currProcess == -1) {
-		if(readyQueue == NULL)
+		if(readyQueue.empty()) {
+			leaveHiMode();
 			return currProcess;
-		else {
-			currProcessNode = prioRemove(&readyQueue);
-			currProcess = currProcessNode->procNum;
 		}
+		else
+			currProcess = readyQueue.pop();
 	}
-	//printList(readyQueue);
-	//printList(blockedQueue);
 	if(processes[currProcess].timeLeft == 0) {
-		processes[currProcess].timeLeft = processes[currProcess].c;
+		nextJob(currProcess);
 		processes[currProcess].deadline += processes[currProcess].p;
-		prioInsertNode(&blockedQueue, currProcessNode);
-		if(readyQueue == NULL && suspended == NULL){
-			currProcessNode = NULL;
+		blockedQueue.push(processes[currProcess].p, currProcess);
+		if(readyQueue.empty() && suspended.empty()){
+			leaveHiMode();
 			return -1;
-		} else if (suspended != NULL){
-			if(readyQueue != NULL){
-				if(readyQueue->prio < suspended->prio){
-					currProcessNode = prioRemove(&readyQueue);
-					return currProcessNode->procNum;
-				}
+		} else if (!suspended.empty()){
+			if(!readyQueue.empty()){
+				if(readyQueue.topKey() < suspended.topKey())
+					return readyQueue.pop();
 			}
-			currProcessNode = prioRemove(&suspended);
-			return currProcessNode->procNum;
+			return suspended.pop();
 		}
-		currProcessNode = prioRemove(&readyQueue);
-		return currProcessNode->procNum;
+		return readyQueue.pop();
 	} else {
-		if(readyQueue != NULL && readyQueue->prio < currProcessNode->prio) {
+		if(!readyQueue.empty() && readyQueue.topKey() < processes[currProcess].p) {
 			printf("\n====== Pre-Emption ======\n\n");
-			prioInsertNode(&suspended, currProcessNode);
-			currProcessNode = prioRemove(&readyQueue);
-			return currProcessNode->procNum;
+			preemptions++;
+			suspended.push(processes[currProcess].p, currProcess);
+			return readyQueue.pop();
 		}
 		return currProcess;
 	}
@@ -185,9 +335,8 @@ int RMSScheduler()
 
 		YOU HAVE A VARIABLE CALLED readyQueue WHICH HOLDS A LIST OF PROCESSES
 		READY TO RUN, AND blockedQueue WHICH HOLDS A LIST OF PROCESSES THAT
-		ARE BLOCKED. THERE IS A THIRD VARIABLE currProcessNode WHICH SHOULD
-		POINT TO THE CURRENTLY RUNNING PROCESS DEQUEUED FROM readyQueue,
-		AND A VARIABLE CALLED suspended WHICH IS USED TO STORE THE INFORMATION
+		ARE BLOCKED. currProcess SHOULD BE THE CURRENTLY RUNNING PROCESS
+		DEQUEUED FROM readyQueue, AND THERE IS A VARIABLE CALLED suspended WHICH IS USED TO STORE THE INFORMATION
 		OF A PRE-EMPTED PROCESS.
 
 		THERE IS ALSO A PROCESS TABLE CALLED processes WHICH IS SET UP 
@@ -201,6 +350,65 @@ int RMSScheduler()
 
 #endif
 
+#if EXPORT_STATS == 1
+
+TSchedStats stats;
+
+// Number of processes waiting to run
+int readyDepth()
+{
+	int depth = 0;
+
+#if SCHEDULER_TYPE == 0
+	int i;
+
+	for(i=0; i<PRIO_LEVELS; i++)
+		depth += activeList[i].size();
+#elif SCHEDULER_TYPE == 1
+	depth = readyQueue.size() + suspended.size();
+#endif
+
+	return depth;
+}
+
+// Publishes the current counters to shared memory
+void exportStats(int running)
+{
+	static struct timespec lastTime;
+	static long lastTick = 0;
+
+	if(timerTick == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &lastTime);
+		lastTick = 0;
+	}
+	else if(timerTick - lastTick >= STATS_RATE_TICKS || (!running && timerTick > lastTick))
+	{
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		double secs = (now.tv_sec - lastTime.tv_sec) + (now.tv_nsec - lastTime.tv_nsec) / 1e9;
+
+		if(secs > 0)
+			stats.ticksPerSec = (timerTick - lastTick) / secs;
+
+		lastTime = now;
+		lastTick = timerTick;
+	}
+
+	stats.running = running;
+	stats.schedulerType = SCHEDULER_TYPE;
+	stats.currProcess = currProcess;
+	stats.readyDepth = readyDepth();
+	stats.tick = timerTick;
+	stats.listSwaps = listSwaps;
+	stats.preemptions = preemptions;
+	stats.deadlineMisses = deadlineMisses;
+	publishStats(&stats);
+}
+#endif
+
 void timerISR()
 {
 
@@ -211,8 +419,6 @@ void timerISR()
 #endif
 	
 #if SCHEDULER_TYPE == 0
-	static int prevProcess=-1;
-
 	// To avoid repetitiveness for hundreds of cycles, we will only print when there's
 	// a change of processes
 	if(currProcess != prevProcess)
@@ -229,15 +435,41 @@ void timerISR()
 
 	printf("Time: %d ", timerTick);
 	if(currProcess == -1)
+	{
+#if TICKLESS_IDLE == 1
+		// Nothing can run until the next release from the blocked queue,
+		// so we skip the idle ticks and report them as a single interval.
+		int wakeup = nextRelease(blockedQueue, timerTick);
+
+		if(wakeup < 0 || wakeup > endTick)
+			wakeup = endTick;
+
+		if(wakeup > timerTick + 1)
+		{
+			printf("to %d ", wakeup - 1);
+			timerTick = wakeup - 1;
+		}
+#endif
 		printf("---\n");
+	}
 	else
 	{
 		// If we have busted a processe's deadline, print !! first
 		int bustedDeadline = (timerTick >= processes[currProcess].deadline);
 
 		if(bustedDeadline)
+		{
 			printf("!! ");
 
+			// A late job is printed with !! on every tick until it is
+			// done, but it only misses its deadline once
+			if(processes[currProcess].missedDeadline != processes[currProcess].deadline)
+			{
+				processes[currProcess].missedDeadline = processes[currProcess].deadline;
+				deadlineMisses++;
+			}
+		}
+
 		printf("P%d Deadline: %d", currProcess+1, processes[currProcess].deadline);
 
 		if(bustedDeadline)
@@ -248,6 +480,10 @@ void timerISR()
 
 #endif
 
+#if EXPORT_STATS == 1
+	exportStats(1);
+#endif
+
 	// Increment timerTick. You will use this for scheduling decisions.
 	timerTick++;
 }
@@ -258,30 +494,38 @@ void startTimer()
 	// ISR, start an actual physical timer, etc. Here we will simulate a timer
 	// by calling timerISR every millisecond
 
-	int i;
-
 #if SCHEDULER_TYPE==0
+	int i, j;
 	int total = processes[currProcess].quantum;
 
 	for(i=0; i<PRIO_LEVELS; i++)
 	{
-		total += totalQuantum(activeList[i]);
+		for(j=0; j<activeList[i].size(); j++)
+			total += processes[activeList[i].at(j)].quantum;
 	}
 
 	for(i=0; i<NUM_RUNS * total; i++)
 	{
 		timerISR();
-		usleep(1000);
+#if TICK_USEC > 0
+		usleep(TICK_USEC);
+#endif
 	}
 #elif SCHEDULER_TYPE==1
 
 	// Find LCM of all periods
-	int lcm = prioLCM(readyQueue);
+	int lcm = periodLCM(readyQueue);
+
+	// When TICKLESS_IDLE is on, timerISR may advance timerTick by more than
+	// one, so we run until we reach endTick rather than counting calls.
+	endTick = NUM_RUNS*lcm;
 
-	for(i=0; i<NUM_RUNS*lcm; i++)
+	while(timerTick < endTick)
 	{
 		timerISR();
-		usleep(1000);
+#if TICK_USEC > 0
+		usleep(TICK_USEC);
+#endif
 	}
 #endif
 }
@@ -299,28 +543,46 @@ void startOS()
 	}
 
 	// set the first process
-	currProcess = remove(&activeList[currPrio]);
+	currProcess = activeList[currPrio].pop();
 
 #elif SCHEDULER_TYPE == 1
-	currProcessNode = prioRemove(&readyQueue);
-	currProcess = currProcessNode->procNum;
+	currProcess = readyQueue.pop();
+#endif
+
+#if EXPORT_STATS == 1
+	if(openStats(1) < 0)
+		printf("WARNING: Cannot open shared memory for statistics\n");
+
+	// The pid never changes, so we only look it up once
+	stats.pid = getpid();
 #endif
 
 	// Start the timer
 	startTimer();
 
+#if EXPORT_STATS == 1
+	exportStats(0);
+	closeStats(0);
+#endif
+
 #if SCHEDULER_TYPE == 0
 	int i;
 
+	// Empty both lists so that initOS can be called again for another run
 	for(i=0; i<PRIO_LEVELS; i++)
-		destroy(&activeList[i]);
+	{
+		activeList[i].clear();
+		expiredList[i].clear();
+	}
 
 #elif SCHEDULER_TYPE == 1
-	prioDestroy(&readyQueue);
-	prioDestroy(&blockedQueue);
+	readyQueue.clear();
+	blockedQueue.clear();
+	suspended.clear();
 
-	if(suspended != NULL)
-		free(suspended);
+	if(numHiProcs > 0)
+		printf("\nMode switches: %d LO jobs dropped: %d of %d (%.1f%%)\n", modeSwitches,
+			loJobsDropped, loJobs, loJobs ? 100.0 * loJobsDropped / loJobs : 0.0);
 #endif
 }
 
@@ -331,24 +593,34 @@ void initOS()
 	timerTick=0;
 	currProcess = 0;
 	currPrio = 0;
+	prevProcess = -1;
+	listSwaps = 0;
+	preemptions = 0;
+	deadlineMisses = 0;
 #if SCHEDULER_TYPE == 0
 	int i;
 
-	// Set both queue lists to NULL
+	// Empty both queue lists
 	for(i=0; i<PRIO_LEVELS; i++)
 	{
-		queueList1[i]=NULL;
-		queueList2[i]=NULL;
+		queueList1[i].clear();
+		queueList2[i].clear();
 	}
 #elif SCHEDULER_TYPE == 1
 
-	// Set readyQueue and blockedQueue to NULL
-	readyQueue=NULL;
-	blockedQueue=NULL;
+	// Empty readyQueue and blockedQueue
+	readyQueue.clear();
+	blockedQueue.clear();
 
 	// The suspended variable is used to store
 	// which process was pre-empted.
-	suspended = NULL;
+	suspended.clear();
+
+	critMode = LO_CRIT;
+	numHiProcs = 0;
+	modeSwitches = 0;
+	loJobs = 0;
+	loJobsDropped = 0;
 #endif
 
 }
@@ -374,7 +646,7 @@ int addProcess(int priority)
 	processes[procCount].timeLeft = processes[procCount].quantum;
 
 	// Add to the active list
-	insert(&activeList[priority], processes[procCount].procNum, processes[procCount].quantum);
+	activeList[priority].push(processes[procCount].procNum);
 	procCount++;
 	return 0;
 }
@@ -382,18 +654,34 @@ int addProcess(int priority)
 
 // Adds a process to the process table
 int addProcess(int p, int c)
+{
+	return addMCProcess(p, c, c, LO_CRIT);
+}
+
+// Adds a process with a LO and HI criticality budget to the process table
+int addMCProcess(int p, int cLo, int cHi, int crit)
 {
 	if(procCount >= NUM_PROCESSES)
 		return -1;
 
-		// Insert process data into the process table
-		processes[procCount].p = p;
-		processes[procCount].c = c;
-		processes[procCount].timeLeft=c;
-		processes[procCount].deadline = p;
+	// Insert process data into the process table
+	processes[procCount].p = p;
+	processes[procCount].c = cLo;
+	processes[procCount].cHi = cHi;
+	processes[procCount].crit = crit;
+	processes[procCount].jobNum = 0;
+	processes[procCount].demand = jobDemand(procCount);
+	processes[procCount].timeLeft = processes[procCount].demand;
+	processes[procCount].deadline = p;
+	processes[procCount].missedDeadline = 0;
+
+	if(crit == HI_CRIT)
+		numHiProcs++;
+	else
+		loJobs++;
 
-		// And add to the ready queue.
-		prioInsert(&readyQueue, procCount, p, p);
+	// And add to the ready queue.
+	readyQueue.push(p, procCount);
 	procCount++;
 	return 0;
 }
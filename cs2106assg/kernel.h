@@ -6,12 +6,48 @@
 // Choose scheduler type
 // 0 = LINUX
 // 1 = RMS
+// Can also be set on the command line, e.g. -DSCHEDULER_TYPE=1
 
+#ifndef SCHEDULER_TYPE
 #define SCHEDULER_TYPE 0
+#endif
 
 #define NUM_PROCESSES 	10
 #define NUM_RUNS		2
 
+// Length of a simulated timer tick in microseconds. Set to 0 on the
+// command line (-DTICK_USEC=0) to run the simulation at full speed.
+#ifndef TICK_USEC
+#define TICK_USEC		1000
+#endif
+
+// Number of simulated CPUs for the multi-CPU simulators
+#define NUM_CPUS		4
+
+// Tickless idle for the RMS scheduler
+// 0 = Tick every millisecond even when idle
+// 1 = When idle, skip straight to the next release time
+// Can also be set on the command line, e.g. -DTICKLESS_IDLE=1
+
+#ifndef TICKLESS_IDLE
+#define TICKLESS_IDLE	0
+#endif
+
+// Live statistics in shared memory, see schedstats.h
+// 0 = Off
+// 1 = Publish counters every tick for schedtop to read
+
+#ifndef EXPORT_STATS
+#define EXPORT_STATS	0
+#endif
+
+// Mixed criticality for the RMS scheduler. Every MC_OVERRUN_PERIOD-th
+// job of a HI_CRIT process runs for its HI budget, all other jobs run
+// for their LO budget.
+#define LO_CRIT			0
+#define HI_CRIT			1
+#define MC_OVERRUN_PERIOD	4
+
 #define PRIO_LEVELS		140
 #define QUANTUM_STEP	2
 #define QUANTUM_MIN		20
@@ -21,6 +57,7 @@ void initOS();
 int addProcess(int priority);
 #elif SCHEDULER_TYPE == 1
 int addProcess(int p, int c);
+int addMCProcess(int p, int cLo, int cHi, int crit);
 #endif
 
 void startOS();
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include "mprt.h"
+
+int main()
+{
+	initMP();
+
+	addMPTask(4, 1);
+	addMPTask(8, 2);
+	addMPTask(12, 3);
+	addMPTask(3, 1);
+	addMPTask(6, 2);
+	addMPTask(8, 3);
+	addMPTask(10, 7);
+
+	int mode;
+
+	for(mode=MP_PARTITIONED_FFD; mode<=MP_GLOBAL_RM; mode++)
+		runMP(mode, NUM_CPUS);
+
+	printf("\nCores needed: FFD %d BFD %d Global EDF %d Global RM %d\n",
+		coresNeeded(MP_PARTITIONED_FFD), coresNeeded(MP_PARTITIONED_BFD),
+		coresNeeded(MP_GLOBAL_EDF), coresNeeded(MP_GLOBAL_RM));
+
+	// Regression case: the hyperperiod of these two is far above
+	// MP_MAX_HORIZON, so the simulation stops with both jobs still running.
+	// Each task has a CPU to itself, so that must not count as a miss.
+	initMP();
+	addMPTask(1009, 900);
+	addMPTask(1013, 900);
+
+	int failed = 0;
+
+	for(mode=MP_PARTITIONED_FFD; mode<=MP_GLOBAL_RM; mode++)
+		if(coresNeeded(mode) != 2)
+		{
+			printf("REGRESSION: %d cores needed for the long hyperperiod set in mode %d, expected 2\n",
+				coresNeeded(mode), mode);
+			failed = 1;
+		}
+
+	return failed;
+}
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include "tqueue.h"
+#include "batchrms.h"
+#include "mprt.h"
+
+// Global simulations stop after this many ticks even if the hyperperiod
+// is longer
+#define MP_MAX_HORIZON	1000000
+
+typedef struct
+{
+	int p;
+	int c;
+} TMPTask;
+
+TMPTask mpTasks[MP_MAX_TASKS];
+int numMPTasks;
+
+// Set by coresNeeded to stop runMP from printing
+static int quiet = 0;
+
+static const char *modeNames[] =
+{
+	"PARTITIONED FFD",
+	"PARTITIONED BFD",
+	"GLOBAL EDF",
+	"GLOBAL RM"
+};
+
+void initMP()
+{
+	numMPTasks = 0;
+}
+
+int addMPTask(int p, int c)
+{
+	if(numMPTasks >= MP_MAX_TASKS)
+		return -1;
+
+	mpTasks[numMPTasks].p = p;
+	mpTasks[numMPTasks].c = c;
+	return numMPTasks++;
+}
+
+static double utilization(int t)
+{
+	return (double) mpTasks[t].c / mpTasks[t].p;
+}
+
+// Response time analysis for the tasks on one core under RMS. A task's
+// higher priority tasks are the ones with a shorter period, or the same
+// period and a lower task number. Returns 1 if every task on the core
+// finishes within its period.
+static int coreSchedulable(int cpu, int *core)
+{
+	int i, j;
+
+	for(i=0; i<numMPTasks; i++)
+	{
+		if(core[i] != cpu)
+			continue;
+
+		int r = mpTasks[i].c, next;
+
+		while(1)
+		{
+			next = mpTasks[i].c;
+
+			for(j=0; j<numMPTasks; j++)
+				if(j != i && core[j] == cpu && (mpTasks[j].p < mpTasks[i].p ||
+					(mpTasks[j].p == mpTasks[i].p && j < i)))
+					next += (r + mpTasks[j].p - 1) / mpTasks[j].p * mpTasks[j].c;
+
+			if(next > mpTasks[i].p)
+				return 0;
+
+			if(next == r)
+				break;
+
+			r = next;
+		}
+	}
+
+	return 1;
+}
+
+static double coreUtilization(int cpu, int *core, int *count)
+{
+	double u = 0;
+	int i;
+
+	*count = 0;
+
+	for(i=0; i<numMPTasks; i++)
+		if(core[i] == cpu)
+		{
+			u += utilization(i);
+			(*count)++;
+		}
+
+	return u;
+}
+
+// Assigns tasks to cores in order of decreasing utilization. A task fits
+// on a core if the core still passes response time analysis with it.
+// First fit takes the first core that fits, best fit takes the fullest
+// core that fits. Tasks that fit nowhere get core -1.
+static void partition(int mode, int numCPUs, int *core)
+{
+	int order[MP_MAX_TASKS];
+	int i, j, cpu;
+
+	for(i=0; i<numMPTasks; i++)
+	{
+		order[i] = i;
+		core[i] = -1;
+	}
+
+	// Insertion sort by decreasing c/p, keeping task order for ties
+	for(i=1; i<numMPTasks; i++)
+	{
+		int t = order[i];
+
+		for(j=i; j>0 && (long) mpTasks[t].c * mpTasks[order[j-1]].p >
+			(long) mpTasks[order[j-1]].c * mpTasks[t].p; j--)
+			order[j] = order[j-1];
+
+		order[j] = t;
+	}
+
+	for(i=0; i<numMPTasks; i++)
+	{
+		int t = order[i], best = -1;
+		double bestU = -1;
+
+		for(cpu=0; cpu<numCPUs; cpu++)
+		{
+			int count;
+			double u = coreUtilization(cpu, core, &count);
+
+			// Each core is simulated by the batch RMS simulator, which has
+			// a limited number of tasks per simulation.
+			if(count >= BATCH_MAX_TASKS)
+				continue;
+
+			core[t] = cpu;
+			int fits = coreSchedulable(cpu, core);
+			core[t] = -1;
+
+			if(!fits)
+				continue;
+
+			if(mode == MP_PARTITIONED_FFD)
+			{
+				best = cpu;
+				break;
+			}
+
+			if(u > bestU)
+			{
+				best = cpu;
+				bestU = u;
+			}
+		}
+
+		core[t] = best;
+	}
+}
+
+static int runPartitioned(int mode, int numCPUs)
+{
+	int core[MP_MAX_TASKS];
+	int i, cpu, schedulable = 1;
+	TBatch batch;
+
+	partition(mode, numCPUs, core);
+
+	// Run RMS on every core, one simulation per core. Like runGlobal we
+	// stop at MP_MAX_HORIZON if the hyperperiod is longer.
+	initBatch(&batch, numCPUs);
+	batch.horizonCap = MP_MAX_HORIZON;
+
+	for(i=0; i<numMPTasks; i++)
+		if(core[i] >= 0)
+			batchAddProcess(&batch, core[i], mpTasks[i].p, mpTasks[i].c);
+
+	runBatch(&batch);
+
+	for(cpu=0; cpu<numCPUs; cpu++)
+	{
+		int count;
+		double u = coreUtilization(cpu, core, &count);
+
+		if(!batchSchedulable(&batch, cpu))
+			schedulable = 0;
+
+		if(quiet)
+			continue;
+
+		printf("CPU%d:", cpu);
+
+		for(i=0; i<numMPTasks; i++)
+			if(core[i] == cpu)
+				printf(" P%d", i+1);
+
+		printf(" Utilization: %.3f Deadline misses: %d\n", u, batch.missTicks[cpu]);
+
+		if(batch.capped[cpu])
+			printf("CPU%d: Hyperperiod too long, only the first %d ticks were simulated\n", cpu, MP_MAX_HORIZON);
+	}
+
+	for(i=0; i<numMPTasks; i++)
+		if(core[i] < 0)
+		{
+			schedulable = 0;
+
+			if(!quiet)
+				printf("P%d (utilization %.3f) does not fit on any CPU\n", i+1, utilization(i));
+		}
+
+	freeBatch(&batch);
+	return schedulable;
+}
+
+static long mpGCD(long a, long b)
+{
+	if(b==0)
+		return a;
+
+	return mpGCD(b, a%b);
+}
+
+static int runGlobal(int mode, int numCPUs)
+{
+	// Tasks with an unfinished job, keyed by absolute deadline for EDF or
+	// period for RM. A task has at most one job in the queue. Ties go to
+	// the most recently released job, so the second part of the key counts
+	// down with every release.
+	TIndexedHeap<std::pair<int, int> > readyQueue(MP_MAX_TASKS);
+	int releases = 0;
+	int remaining[MP_MAX_TASKS], deadline[MP_MAX_TASKS], lastCPU[MP_MAX_TASKS];
+	int busy[MP_MAX_CPUS], cpuTaskNow[MP_MAX_CPUS];
+	int misses = 0, migrations = 0;
+	int i, cpu, tick;
+
+	long hyper = 1;
+
+	for(i=0; i<numMPTasks; i++)
+	{
+		hyper = hyper / mpGCD(hyper, mpTasks[i].p) * mpTasks[i].p;
+
+		if(hyper > MP_MAX_HORIZON)
+			hyper = MP_MAX_HORIZON;
+	}
+
+	int horizon = (int) (hyper * NUM_RUNS > MP_MAX_HORIZON ? MP_MAX_HORIZON : hyper * NUM_RUNS);
+
+	for(i=0; i<numMPTasks; i++)
+	{
+		remaining[i] = 0;
+		deadline[i] = 0;
+		lastCPU[i] = -1;
+	}
+
+	for(cpu=0; cpu<numCPUs; cpu++)
+		busy[cpu] = 0;
+
+	for(tick=0; tick<horizon; tick++)
+	{
+		// Release new jobs. A job that is still unfinished at its
+		// deadline has missed it and is dropped.
+		for(i=0; i<numMPTasks; i++)
+		{
+			if(tick % mpTasks[i].p != 0)
+				continue;
+
+			if(remaining[i] > 0)
+			{
+				misses++;
+				readyQueue.remove(i);
+			}
+
+			remaining[i] = mpTasks[i].c;
+			deadline[i] = tick + mpTasks[i].p;
+
+			if(remaining[i] > 0)
+				readyQueue.push(i, std::make_pair((mode == MP_GLOBAL_EDF) ? deadline[i] : mpTasks[i].p,
+					--releases));
+		}
+
+		// The first numCPUs jobs in the queue run. Jobs that ran on a
+		// CPU last tick keep it, the rest take whatever CPU is free.
+		int running[MP_MAX_CPUS], numRunning = 0;
+
+		for(cpu=0; cpu<numCPUs; cpu++)
+			cpuTaskNow[cpu] = -1;
+
+		while(!readyQueue.empty() && numRunning<numCPUs)
+			running[numRunning++] = readyQueue.pop();
+
+		// Put them back with the same keys
+		for(i=0; i<numRunning; i++)
+			readyQueue.push(running[i], readyQueue.key(running[i]));
+
+		for(i=0; i<numRunning; i++)
+		{
+			int t = running[i];
+
+			if(lastCPU[t] >= 0 && lastCPU[t] < numCPUs && cpuTaskNow[lastCPU[t]] < 0)
+				cpuTaskNow[lastCPU[t]] = t;
+			else
+				running[i] = -1 - t;
+		}
+
+		for(i=0; i<numRunning; i++)
+		{
+			if(running[i] >= 0)
+				continue;
+
+			int t = -1 - running[i];
+
+			for(cpu=0; cpuTaskNow[cpu] >= 0; cpu++)
+				;
+
+			if(lastCPU[t] >= 0)
+				migrations++;
+
+			cpuTaskNow[cpu] = t;
+		}
+
+		for(cpu=0; cpu<numCPUs; cpu++)
+		{
+			int t = cpuTaskNow[cpu];
+
+			if(t < 0)
+				continue;
+
+			busy[cpu]++;
+			lastCPU[t] = cpu;
+
+			if(--remaining[t] == 0)
+			{
+				readyQueue.remove(t);
+				lastCPU[t] = -1;
+			}
+		}
+	}
+
+	// Jobs still unfinished at the end have missed their deadline if it has
+	// come. When the horizon was cut to MP_MAX_HORIZON a job may still have
+	// time left, and then we cannot tell, so we do not count it.
+	for(i=0; i<numMPTasks; i++)
+		if(remaining[i] > 0 && deadline[i] <= horizon)
+			misses++;
+
+	if(!quiet)
+	{
+		double total = 0;
+
+		for(i=0; i<numMPTasks; i++)
+			total += utilization(i);
+
+		for(cpu=0; cpu<numCPUs; cpu++)
+			printf("CPU%d: Utilization: %.3f\n", cpu, horizon ? (double) busy[cpu] / horizon : 0);
+
+		printf("Task set utilization: %.3f Ticks: %d Migrations: %d Deadline misses: %d\n",
+			total, horizon, migrations, misses);
+	}
+
+	return misses == 0;
+}
+
+int runMP(int mode, int numCPUs)
+{
+	int schedulable;
+
+	if(numCPUs < 1 || numCPUs > MP_MAX_CPUS || mode < MP_PARTITIONED_FFD || mode > MP_GLOBAL_RM)
+		return 0;
+
+	if(!quiet)
+		printf("\n******* %s ON %d CPUS *******\n\n", modeNames[mode], numCPUs);
+
+	if(mode == MP_PARTITIONED_FFD || mode == MP_PARTITIONED_BFD)
+		schedulable = runPartitioned(mode, numCPUs);
+	else
+		schedulable = runGlobal(mode, numCPUs);
+
+	if(!quiet)
+		printf("%s\n", schedulable ? "SCHEDULABLE" : "NOT SCHEDULABLE");
+
+	return schedulable;
+}
+
+int coresNeeded(int mode)
+{
+	int numCPUs, found = -1;
+
+	quiet = 1;
+
+	for(numCPUs=1; numCPUs<=MP_MAX_CPUS && found<0; numCPUs++)
+		if(runMP(mode, numCPUs))
+			found = numCPUs;
+
+	quiet = 0;
+	return found;
+}
@@ -0,0 +1,38 @@
+#ifndef __MPRT_H__
+#define __MPRT_H__
+
+#include "kernel.h"
+
+// This file implements multiprocessor real-time scheduling of periodic
+// task sets. In partitioned mode every task is assigned to one core with a
+// bin-packing heuristic and each core runs RMS on its own. In global mode
+// all cores share a single ready queue.
+
+#define MP_MAX_CPUS		16
+#define MP_MAX_TASKS	64
+
+// Multiprocessor modes
+enum
+{
+	MP_PARTITIONED_FFD=0,	// First-fit decreasing utilization, RMS per core
+	MP_PARTITIONED_BFD,		// Best-fit decreasing utilization, RMS per core
+	MP_GLOBAL_EDF,			// Global earliest deadline first
+	MP_GLOBAL_RM			// Global rate monotonic
+};
+
+void initMP();
+
+// Adds a periodic task with period p and execution time c.
+// Returns -1 if there are too many tasks.
+int addMPTask(int p, int c);
+
+// Schedules the task set on numCPUs cores in the given mode, prints the
+// per-core utilization and deadline misses, and returns 1 if the task set
+// is schedulable.
+int runMP(int mode, int numCPUs);
+
+// Returns the smallest number of cores (up to MP_MAX_CPUS) on which
+// the task set is schedulable in the given mode, or -1 if there is none.
+int coresNeeded(int mode);
+
+#endif
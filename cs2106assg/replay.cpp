@@ -0,0 +1,562 @@
+// Replay harness for the schedulers in kernel.cpp.
+//
+// Runs a fixed corpus of task sets through startOS(), turns the
+// timerISR() output into a normalized dispatch trace, and compares it with
+// the golden trace for the policy. It also measures how many ticks per
+// second the simulator manages, and warns if that falls more than
+// REGRESSION_THRESHOLD below the baseline.
+//
+// Throughput depends on the machine and on whatever else it is doing, so
+// the baseline is not part of the golden files. It is recorded on this
+// machine the first time replay runs, in golden/<build>.local.tps, which
+// git ignores. Even on one machine the numbers move by more than the
+// threshold from run to run, so a throughput regression is only reported.
+// Only a schedule that differs from the golden trace makes replay fail.
+//
+// Build one binary per policy, with the tick sleep turned off. Tickless
+// idle must not change the RMS schedule, so the third build replays the RMS
+// corpus with it on and compares against the same golden trace:
+//	g++ -O2 -DSCHEDULER_TYPE=0 -DTICK_USEC=0 -o replay replay.cpp kernel.cpp
+//	g++ -O2 -DSCHEDULER_TYPE=1 -DTICK_USEC=0 -o replay replay.cpp kernel.cpp batchrms.cpp
+//	g++ -O2 -DSCHEDULER_TYPE=1 -DTICKLESS_IDLE=1 -DTICK_USEC=0 -o replay replay.cpp kernel.cpp batchrms.cpp
+//
+// The RMS builds can also check the batch simulator against the kernel.
+// Build them with -mavx2 too, to check its vector code.
+//
+// Usage:
+//	./replay			Compare against golden/<policy>.trace
+//	./replay record		Write new golden traces and a new local baseline
+//	./replay batch		RMS only: compare batchrms.cpp with the kernel
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "kernel.h"
+#include "batchrms.h"
+
+#if TICK_USEC != 0
+#warning "replay measures throughput, build with -DTICK_USEC=0"
+#endif
+
+#define GOLDEN_DIR	"golden"
+
+// Warn about a throughput regression if ticks/sec drops by more than this
+#define REGRESSION_THRESHOLD	0.25
+
+// Throughput baseline for this machine, see the top of this file
+#define BASELINE_FILE	GOLDEN_DIR "/" BUILD ".local.tps"
+
+// Each case is timed this many times and the best run is kept
+#define REPEATS		5
+#define MIN_SECS	0.05
+
+#define LINE_LEN	256
+
+extern int timerTick;
+
+#if SCHEDULER_TYPE == 0
+
+#define POLICY	"linux"
+#define BUILD	POLICY
+
+// Each task set is a list of priorities terminated by -1
+static int corpus[][NUM_PROCESSES+1] =
+{
+	{15, 106, 109, 139, 109, 15, 139, 109, -1},
+	{0, 139, -1},
+	{50, 50, 50, 50, -1},
+	{139, 120, 100, 80, 60, 40, 20, 0, -1},
+	{70, -1},
+	{10, 10, 130, 130, 70, 70, 5, 135, 1, 138, -1},
+};
+
+static void addCase(int *set)
+{
+	int i;
+
+	for(i=0; set[i] >= 0; i++)
+		addProcess(set[i]);
+}
+
+#elif SCHEDULER_TYPE == 1
+
+#define POLICY	"rms"
+
+// Skipping idle ticks makes the tickless build faster, so it gets a
+// throughput baseline of its own
+#if TICKLESS_IDLE == 1
+#define BUILD	"rms-tickless"
+#else
+#define BUILD	POLICY
+#endif
+
+// Each task set is a list of (period, execution time) pairs
+// terminated by -1
+static int corpus[][2*NUM_PROCESSES+1] =
+{
+	{4, 1, 8, 2, 12, 3, -1},
+	{3, 1, 6, 2, 8, 3, -1},
+	{10, 1, 20, 2, 30, 3, -1},
+	{5, 2, 5, 2, 10, 1, -1},
+	{6, 1, 6, 1, 6, 1, 12, 2, 12, 3, -1},
+	{2, 1, 3, 1, 4, 1, 6, 1, -1},
+	{20, 3, 40, 5, 60, 7, 80, 9, 120, 10, -1},
+	{7, 2, 11, 3, 13, 4, -1},
+};
+
+static void addCase(int *set)
+{
+	int i;
+
+	for(i=0; set[i] >= 0; i+=2)
+		addProcess(set[i], set[i+1]);
+}
+
+#endif
+
+#define NUM_CASES	((int) (sizeof(corpus) / sizeof(corpus[0])))
+
+// A normalized trace is a list of "tick process" lines, written only when
+// the running process (or whether it is past its deadline) changes. This
+// hides the difference between the LINUX and RMS print formats, and makes
+// tickless idle intervals look the same as idle ticks.
+typedef struct
+{
+	char **lines;
+	int count, size;
+} TTrace;
+
+static void addLine(TTrace *trace, const char *line)
+{
+	if(trace->count == trace->size)
+	{
+		trace->size = trace->size ? 2 * trace->size : 64;
+		trace->lines = (char **) realloc(trace->lines, trace->size * sizeof(char *));
+	}
+
+	trace->lines[trace->count++] = strdup(line);
+}
+
+static void freeTrace(TTrace *trace)
+{
+	int i;
+
+	for(i=0; i<trace->count; i++)
+		free(trace->lines[i]);
+
+	free(trace->lines);
+	trace->lines = NULL;
+	trace->count = trace->size = 0;
+}
+
+// Turns one line of timerISR output into "tick process". Returns 0 for
+// lines that are not dispatch records, like the SWAPPED LIST banner.
+static int normalize(const char *line, char *out)
+{
+	int tick, proc;
+	char rest[LINE_LEN];
+
+	if(sscanf(line, "Time: %d %[^\n]", &tick, rest) != 2)
+		return 0;
+
+	if(sscanf(rest, "Process: %d", &proc) == 1)
+		sprintf(out, "%d P%d", tick, proc);
+	else if(strstr(rest, "---") != NULL)
+		sprintf(out, "%d ---", tick);
+	else if(sscanf(rest, "!! P%d", &proc) == 1)
+		sprintf(out, "%d P%d !!", tick, proc);
+	else if(sscanf(rest, "P%d", &proc) == 1)
+		sprintf(out, "%d P%d", tick, proc);
+	else
+		return 0;
+
+	return 1;
+}
+
+// Runs a task set with stdout redirected to a temporary file, and returns
+// the file, rewound, and the run time.
+static FILE *runCaptured(int *set, double *secs)
+{
+	FILE *tmp = tmpfile();
+
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	dup2(fileno(tmp), STDOUT_FILENO);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	initOS();
+	addCase(set);
+	startOS();
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	*secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	rewind(tmp);
+	return tmp;
+}
+
+// Runs one case and returns the normalized trace, the number of ticks and
+// the run time.
+static void runCase(int c, TTrace *trace, int *ticks, double *secs)
+{
+	FILE *tmp = runCaptured(corpus[c], secs);
+
+	*ticks = timerTick;
+
+	if(trace == NULL)
+	{
+		fclose(tmp);
+		return;
+	}
+
+	char line[LINE_LEN], norm[LINE_LEN], prev[LINE_LEN] = "";
+
+	while(fgets(line, LINE_LEN, tmp) != NULL)
+	{
+		if(!normalize(line, norm))
+			continue;
+
+		// Only keep changes. Compare everything after the tick number.
+		const char *what = strchr(norm, ' ');
+
+		if(strcmp(what, prev) != 0)
+		{
+			addLine(trace, norm);
+			strcpy(prev, what);
+		}
+	}
+
+	fclose(tmp);
+}
+
+// Best ticks/sec over several timing windows. Short cases are run
+// repeatedly until a window lasts at least MIN_SECS.
+static double measure(int c, TTrace *trace)
+{
+	double best = 0;
+	int i;
+
+	for(i=0; i<REPEATS; i++)
+	{
+		long totalTicks = 0;
+		double totalSecs = 0;
+
+		do
+		{
+			int ticks;
+			double secs;
+
+			runCase(c, trace, &ticks, &secs);
+			trace = NULL;
+
+			totalTicks += ticks;
+			totalSecs += secs;
+		} while(totalSecs < MIN_SECS);
+
+		if(totalTicks / totalSecs > best)
+			best = totalTicks / totalSecs;
+	}
+
+	return best;
+}
+
+static int record()
+{
+	FILE *traceFile = fopen(GOLDEN_DIR "/" POLICY ".trace", "w");
+	FILE *tpsFile = fopen(BASELINE_FILE, "w");
+	int c, i;
+
+	if(traceFile == NULL || tpsFile == NULL)
+	{
+		fprintf(stderr, "Cannot write golden files in %s\n", GOLDEN_DIR);
+		return -1;
+	}
+
+	for(c=0; c<NUM_CASES; c++)
+	{
+		TTrace trace = {NULL, 0, 0};
+		double tps = measure(c, &trace);
+
+		fprintf(traceFile, "case %d\n", c+1);
+
+		for(i=0; i<trace.count; i++)
+			fprintf(traceFile, "%s\n", trace.lines[i]);
+
+		fprintf(tpsFile, "%d %.0f\n", c+1, tps);
+		printf("case %d: recorded %d dispatches, %.0f ticks/s\n", c+1, trace.count, tps);
+		freeTrace(&trace);
+	}
+
+	fclose(traceFile);
+	fclose(tpsFile);
+	return 0;
+}
+
+// Reads the golden trace for case c (numbered from 1)
+static int loadGolden(FILE *fp, int c, TTrace *trace)
+{
+	char line[LINE_LEN];
+	int found = 0, num;
+
+	rewind(fp);
+
+	while(fgets(line, LINE_LEN, fp) != NULL)
+	{
+		line[strcspn(line, "\n")] = '\0';
+
+		if(sscanf(line, "case %d", &num) == 1)
+		{
+			if(found)
+				break;
+
+			found = (num == c);
+		}
+		else if(found)
+			addLine(trace, line);
+	}
+
+	return found;
+}
+
+static double loadBaseline(FILE *fp, int c)
+{
+	int num;
+	double tps;
+
+	if(fp == NULL)
+		return 0;
+
+	rewind(fp);
+
+	while(fscanf(fp, "%d %lf", &num, &tps) == 2)
+		if(num == c)
+			return tps;
+
+	return 0;
+}
+
+// Writes the ticks/sec of every case as the baseline for this machine
+static void saveBaseline(double *tps)
+{
+	FILE *fp = fopen(BASELINE_FILE, "w");
+	int c;
+
+	if(fp == NULL)
+		return;
+
+	for(c=0; c<NUM_CASES; c++)
+		fprintf(fp, "%d %.0f\n", c+1, tps[c]);
+
+	fclose(fp);
+	printf("No throughput baseline for this machine yet, recorded one in %s\n", BASELINE_FILE);
+}
+
+static int compare()
+{
+	FILE *traceFile = fopen(GOLDEN_DIR "/" POLICY ".trace", "r");
+	FILE *tpsFile = fopen(BASELINE_FILE, "r");
+	double measured[NUM_CASES];
+	int c, i, failures = 0, slow = 0;
+
+	if(traceFile == NULL)
+	{
+		fprintf(stderr, "Cannot read %s/%s.trace, run \"replay record\" first\n", GOLDEN_DIR, POLICY);
+		return -1;
+	}
+
+	for(c=0; c<NUM_CASES; c++)
+	{
+		TTrace golden = {NULL, 0, 0}, trace = {NULL, 0, 0};
+		double tps = measure(c, &trace);
+		double baseline = loadBaseline(tpsFile, c+1);
+		int failed = 0;
+
+		measured[c] = tps;
+
+		printf("case %d: ", c+1);
+
+		if(!loadGolden(traceFile, c+1, &golden))
+		{
+			printf("NO GOLDEN TRACE\n");
+			failures++;
+			freeTrace(&trace);
+			continue;
+		}
+
+		// Find the first dispatch that differs
+		for(i=0; i<golden.count && i<trace.count; i++)
+			if(strcmp(golden.lines[i], trace.lines[i]) != 0)
+				break;
+
+		if(i < golden.count || i < trace.count)
+		{
+			printf("SCHEDULE DIFFERS at dispatch %d: expected \"%s\" got \"%s\"\n", i+1,
+				i < golden.count ? golden.lines[i] : "(end)", i < trace.count ? trace.lines[i] : "(end)");
+			failed = 1;
+		}
+		else
+			printf("schedule OK, ");
+
+		printf("%.0f ticks/s", tps);
+
+		if(baseline > 0)
+		{
+			printf(" (baseline %.0f, %+.1f%%)", baseline, 100.0 * (tps - baseline) / baseline);
+
+			if(tps < baseline * (1.0 - REGRESSION_THRESHOLD))
+			{
+				printf(" THROUGHPUT REGRESSION?");
+				slow++;
+			}
+		}
+
+		printf("\n");
+		failures += failed;
+		freeTrace(&golden);
+		freeTrace(&trace);
+	}
+
+	fclose(traceFile);
+
+	if(tpsFile != NULL)
+		fclose(tpsFile);
+	else
+		saveBaseline(measured);
+
+	printf("\n%s: %d of %d cases failed\n", BUILD, failures, NUM_CASES);
+
+	if(slow)
+		printf("%d of %d cases were slower than the baseline, which may just be noise\n", slow, NUM_CASES);
+
+	return failures ? 1 : 0;
+}
+
+#if SCHEDULER_TYPE == 1
+
+// The batch simulator in batchrms.cpp must follow exactly the same rules as
+// RMSScheduler(). "replay batch" runs the corpus and NUM_RANDOM_SETS random
+// task sets through both and compares the idle ticks, the ticks spent past
+// a deadline and the pre-emptions of every set.
+
+extern long preemptions;
+
+#define NUM_RANDOM_SETS	1000
+
+// Random sets take their periods from here, so that the hyperperiod (and
+// the time a set takes) stays small
+static int randomPeriods[] = {2, 3, 4, 5, 6, 8, 10, 12, 15, 20, 24, 30};
+
+#define NUM_RANDOM_PERIODS	((int) (sizeof(randomPeriods) / sizeof(randomPeriods[0])))
+
+typedef struct
+{
+	int idle, late;
+	long preemptions;
+} TCounts;
+
+// Runs a task set through startOS() and counts what it printed
+static void kernelCounts(int *set, TCounts *counts)
+{
+	char line[LINE_LEN], rest[LINE_LEN];
+	int tick, to;
+	double secs;
+	FILE *tmp = runCaptured(set, &secs);
+
+	counts->idle = counts->late = 0;
+	counts->preemptions = preemptions;
+
+	while(fgets(line, LINE_LEN, tmp) != NULL)
+	{
+		if(sscanf(line, "Time: %d %[^\n]", &tick, rest) != 2)
+			continue;
+
+		// A tickless idle interval covers several ticks
+		if(sscanf(rest, "to %d", &to) == 1 && strstr(rest, "---") != NULL)
+			counts->idle += to - tick + 1;
+		else if(strstr(rest, "---") != NULL)
+			counts->idle++;
+		else if(strncmp(rest, "!!", 2) == 0)
+			counts->late++;
+	}
+
+	fclose(tmp);
+}
+
+static int compareBatch()
+{
+	int numSets = NUM_CASES + NUM_RANDOM_SETS;
+	int (*sets)[2*NUM_PROCESSES+1] = (int (*)[2*NUM_PROCESSES+1]) malloc(numSets * sizeof(*sets));
+	int s, i, failures = 0;
+	TBatch batch;
+
+	memcpy(sets, corpus, sizeof(corpus));
+	srand(2106);
+
+	for(s=NUM_CASES; s<numSets; s++)
+	{
+		int n = 1 + rand() % 5;
+
+		for(i=0; i<n; i++)
+		{
+			int p = randomPeriods[rand() % NUM_RANDOM_PERIODS];
+
+			sets[s][2*i] = p;
+			sets[s][2*i+1] = 1 + rand() % (p / 2 + 1);
+		}
+
+		sets[s][2*n] = -1;
+	}
+
+	initBatch(&batch, numSets);
+
+	for(s=0; s<numSets; s++)
+		for(i=0; sets[s][i] >= 0; i+=2)
+			batchAddProcess(&batch, s, sets[s][i], sets[s][i+1]);
+
+	runBatch(&batch);
+
+	for(s=0; s<numSets; s++)
+	{
+		TCounts counts;
+
+		kernelCounts(sets[s], &counts);
+
+		if(counts.idle != batch.idleTicks[s] || counts.late != batch.missTicks[s] ||
+			counts.preemptions != batch.preemptions[s])
+		{
+			printf("set %d: kernel idle %d late %d pre-emptions %ld, batch idle %d late %d pre-emptions %d\n",
+				s+1, counts.idle, counts.late, counts.preemptions,
+				batch.idleTicks[s], batch.missTicks[s], batch.preemptions[s]);
+			failures++;
+		}
+	}
+
+	freeBatch(&batch);
+	free(sets);
+
+	printf("\nbatch: %d of %d sets differ from the kernel\n", failures, numSets);
+	return failures ? 1 : 0;
+}
+
+#endif
+
+int main(int ac, char **av)
+{
+	if(ac > 1 && strcmp(av[1], "record") == 0)
+		return record();
+
+#if SCHEDULER_TYPE == 1
+	if(ac > 1 && strcmp(av[1], "batch") == 0)
+		return compareBatch();
+#endif
+
+	return compare();
+}
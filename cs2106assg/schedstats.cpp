@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "schedstats.h"
+
+static TSchedStats *shared = NULL;
+
+int openStats(int create)
+{
+	int fd;
+
+	if(create)
+		fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	else
+		fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+
+	if(fd < 0)
+		return -1;
+
+	if(create && ftruncate(fd, sizeof(TSchedStats)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	void *p = mmap(NULL, sizeof(TSchedStats), create ? PROT_READ | PROT_WRITE : PROT_READ,
+		MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+		return -1;
+
+	shared = (TSchedStats *) p;
+	return 0;
+}
+
+void publishStats(TSchedStats *s)
+{
+	if(shared == NULL)
+		return;
+
+	unsigned seq = shared->seq;
+
+	// Make the sequence number odd before touching the data, and even
+	// again once all the data is written.
+	__atomic_store_n(&shared->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->seq = seq + 1;
+	memcpy(shared, s, sizeof(TSchedStats));
+
+	__atomic_store_n(&shared->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int readStats(TSchedStats *s)
+{
+	unsigned before, after;
+
+	if(shared == NULL)
+		return -1;
+
+	do
+	{
+		before = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+
+		if(before & 1)
+			continue;
+
+		memcpy(s, shared, sizeof(TSchedStats));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		after = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+	} while((before & 1) || before != after);
+
+	return 0;
+}
+
+void closeStats(int remove)
+{
+	if(shared != NULL)
+		munmap(shared, sizeof(TSchedStats));
+
+	shared = NULL;
+
+	if(remove)
+		shm_unlink(STATS_SHM_NAME);
+}
@@ -0,0 +1,46 @@
+#ifndef __SCHEDSTATS_H__
+#define __SCHEDSTATS_H__
+
+// This file implements live scheduler statistics in a POSIX shared memory
+// segment. The kernel writes the counters every tick, and a viewer like
+// schedtop reads them from another process. Writes are protected by a
+// sequence lock, so the kernel never waits for a reader: a reader that
+// sees the sequence number change while it copies simply tries again.
+
+#define STATS_SHM_NAME	"/cs2106sched"
+
+// How often (in ticks) the kernel recomputes ticksPerSec
+#define STATS_RATE_TICKS	1024
+
+typedef struct
+{
+	// Odd while the kernel is in the middle of an update
+	unsigned seq;
+
+	int pid;
+	int running;
+	int schedulerType;
+	int currProcess;
+	int readyDepth;
+	long tick;
+	double ticksPerSec;
+	long listSwaps;
+	long preemptions;
+	long deadlineMisses;	// Jobs that ran past their deadline
+} TSchedStats;
+
+// Maps the shared memory segment. The kernel passes create=1, viewers
+// pass create=0 to map it read only. Returns 0 on success, -1 on failure.
+int openStats(int create);
+
+// Copies s into the shared memory segment
+void publishStats(TSchedStats *s);
+
+// Copies a consistent snapshot of the shared memory segment into s.
+// Returns 0 on success, -1 if the segment is not open.
+int readStats(TSchedStats *s);
+
+// Unmaps the segment, and removes it if remove is 1
+void closeStats(int remove);
+
+#endif
@@ -0,0 +1,57 @@
+// A top-like viewer for the statistics the kernel exports when
+// EXPORT_STATS is 1 in kernel.h.
+//
+// Build with:
+//	g++ -O2 -o schedtop schedtop.cpp schedstats.cpp
+//
+// Usage:
+//	./schedtop [refresh interval in ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "schedstats.h"
+
+int main(int ac, char **av)
+{
+	int interval = 1000;
+
+	if(ac > 1)
+		interval = strtol(av[1], NULL, 10);
+
+	if(interval < 1)
+		interval = 1000;
+
+	while(openStats(0) < 0)
+	{
+		printf("Waiting for the kernel to start...\n");
+		sleep(1);
+	}
+
+	while(1)
+	{
+		TSchedStats s;
+
+		readStats(&s);
+
+		// Clear the screen and move the cursor to the top left
+		printf("\033[H\033[J");
+		printf("CS2106 scheduler (pid %d, %s) %s\n\n", s.pid, s.schedulerType == 0 ? "LINUX" : "RMS",
+			s.running ? "RUNNING" : "STOPPED");
+		printf("Tick:            %ld\n", s.tick);
+		printf("Ticks/sec:       %.0f\n", s.ticksPerSec);
+
+		if(s.currProcess >= 0)
+			printf("Current process: P%d\n", s.currProcess + 1);
+		else
+			printf("Current process: ---\n");
+
+		printf("Ready queue:     %d\n", s.readyDepth);
+		printf("List swaps:      %ld\n", s.listSwaps);
+		printf("Pre-emptions:    %ld\n", s.preemptions);
+		printf("Deadline misses: %ld\n", s.deadlineMisses);
+		fflush(stdout);
+
+		usleep(interval * 1000);
+	}
+}
@@ -0,0 +1,253 @@
+#ifndef __TQUEUE_H__
+#define __TQUEUE_H__
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// This file implements templated queues for the schedulers. They do the
+// same jobs as the TNode and TPrioNode lists in llist.h and prioll.h, but
+// store their items in contiguous arrays, and the key comparison is a
+// template parameter so the compiler can inline it.
+
+// FIFO queue in a circular buffer that doubles in size when it is full
+template<typename T>
+class TFifo
+{
+	public:
+		TFifo() : buf(4), head(0), count(0) {}
+
+		bool empty() const { return count == 0; }
+		int size() const { return count; }
+
+		// Add an item to the back of the queue
+		void push(const T &item)
+		{
+			if(count == (int) buf.size())
+				grow();
+
+			buf[(head + count) & (buf.size() - 1)] = item;
+			count++;
+		}
+
+		// Remove the item at the front of the queue. Queue must not be empty.
+		T pop()
+		{
+			T item = buf[head];
+
+			head = (head + 1) & (buf.size() - 1);
+			count--;
+			return item;
+		}
+
+		const T &front() const { return buf[head]; }
+
+		// Item i counting from the front
+		const T &at(int i) const { return buf[(head + i) & (buf.size() - 1)]; }
+
+		void clear()
+		{
+			head = 0;
+			count = 0;
+		}
+
+	private:
+		std::vector<T> buf;
+		int head, count;
+
+		void grow()
+		{
+			std::vector<T> bigger(buf.size() * 2);
+			int i;
+
+			for(i=0; i<count; i++)
+				bigger[i] = at(i);
+
+			buf.swap(bigger);
+			head = 0;
+		}
+};
+
+// Priority queue of (key, value) pairs kept in sorted order. Items come
+// out in increasing key order according to Compare. Like prioInsertNode,
+// an item is inserted in front of items with an equal key.
+//
+// Items are stored back to front so that removing the first item does
+// not have to move the others. Index 0 in the interface is always the
+// first item.
+template<typename K, typename T, typename Compare = std::less<K> >
+class TPrioQueue
+{
+	public:
+		bool empty() const { return items.empty(); }
+		int size() const { return (int) items.size(); }
+
+		void push(const K &key, const T &value)
+		{
+			Compare less;
+
+			// Everything that sorts before the new key is at the back, so
+			// the new item goes just in front of those.
+			typename std::vector<TEntry>::iterator pos = std::partition_point(items.begin(), items.end(),
+				[&](const TEntry &e) { return !less(e.key, key); });
+
+			TEntry entry = {key, value};
+			items.insert(pos, entry);
+		}
+
+		// First item. Queue must not be empty.
+		const K &topKey() const { return items.back().key; }
+		const T &top() const { return items.back().value; }
+
+		// Remove and return the first item. Queue must not be empty.
+		T pop()
+		{
+			T value = items.back().value;
+
+			items.pop_back();
+			return value;
+		}
+
+		// Item i in queue order
+		const K &keyAt(int i) const { return items[items.size() - 1 - i].key; }
+		const T &at(int i) const { return items[items.size() - 1 - i].value; }
+
+		// Remove item i in queue order
+		void removeAt(int i) { items.erase(items.begin() + (items.size() - 1 - i)); }
+
+		void clear() { items.clear(); }
+
+	private:
+		typedef struct
+		{
+			K key;
+			T value;
+		} TEntry;
+
+		std::vector<TEntry> items;
+};
+
+// Binary heap of the ids 0 to capacity-1, each with a key. Because the
+// heap remembers where each id is, the key of an id can be changed or the
+// id removed in O(log n).
+template<typename K, typename Compare = std::less<K> >
+class TIndexedHeap
+{
+	public:
+		TIndexedHeap(int capacity) : keys(capacity), pos(capacity, -1) {}
+
+		bool empty() const { return heap.empty(); }
+		int size() const { return (int) heap.size(); }
+		bool contains(int id) const { return pos[id] >= 0; }
+
+		// Id with the smallest key. Heap must not be empty.
+		int top() const { return heap[0]; }
+		const K &topKey() const { return keys[heap[0]]; }
+		const K &key(int id) const { return keys[id]; }
+
+		// Add an id that is not in the heap
+		void push(int id, const K &key)
+		{
+			keys[id] = key;
+			pos[id] = (int) heap.size();
+			heap.push_back(id);
+			siftUp(pos[id]);
+		}
+
+		// Remove and return the id with the smallest key
+		int pop()
+		{
+			int id = heap[0];
+
+			remove(id);
+			return id;
+		}
+
+		// Remove an id that is in the heap
+		void remove(int id)
+		{
+			int i = pos[id];
+			int last = heap.back();
+
+			heap.pop_back();
+			pos[id] = -1;
+
+			if(last == id)
+				return;
+
+			heap[i] = last;
+			pos[last] = i;
+			siftUp(i);
+			siftDown(pos[last]);
+		}
+
+		// Change the key of an id that is in the heap
+		void update(int id, const K &key)
+		{
+			keys[id] = key;
+			siftUp(pos[id]);
+			siftDown(pos[id]);
+		}
+
+		void clear()
+		{
+			int i;
+
+			for(i=0; i<(int) heap.size(); i++)
+				pos[heap[i]] = -1;
+
+			heap.clear();
+		}
+
+	private:
+		std::vector<K> keys;
+		std::vector<int> pos;
+		std::vector<int> heap;
+
+		bool before(int a, int b) const
+		{
+			Compare less;
+
+			return less(keys[heap[a]], keys[heap[b]]);
+		}
+
+		void swapAt(int a, int b)
+		{
+			std::swap(heap[a], heap[b]);
+			pos[heap[a]] = a;
+			pos[heap[b]] = b;
+		}
+
+		void siftUp(int i)
+		{
+			while(i > 0 && before(i, (i - 1) / 2))
+			{
+				swapAt(i, (i - 1) / 2);
+				i = (i - 1) / 2;
+			}
+		}
+
+		void siftDown(int i)
+		{
+			int n = (int) heap.size();
+
+			while(1)
+			{
+				int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+
+				if(l < n && before(l, smallest))
+					smallest = l;
+
+				if(r < n && before(r, smallest))
+					smallest = r;
+
+				if(smallest == i)
+					return;
+
+				swapAt(i, smallest);
+				i = smallest;
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include <string.h>
+#include "btree.h"
+
+// A node that is not the root never has fewer than BTREE_MIN entries. When a
+// removal takes a node below that, we merge it with a neighbour or move some
+// entries over from the neighbour.
+#define BTREE_MIN		(BTREE_ORDER / 4)
+
+// btreeBuild fills nodes this full, so the first few inserts into a freshly
+// built tree do not all have to split nodes.
+#define BTREE_FILL		(BTREE_ORDER * 3 / 4)
+
+// Compares the entry for a record rec with key key to the entry for other.
+// Equal keys are ordered by record number, so every entry in the tree is
+// different. Passing rec = -1 puts key before every record with that key.
+static int compareEntry(TBTree *tree, const void *key, int rec, int other)
+{
+	int result = tree->compare(key, tree->keyOf(tree->ctx, other));
+
+	if (result != 0)
+		return result;
+
+	return (rec > other) - (rec < other);
+}
+
+static TBTreeNode *newNode(TBTree *tree, int leaf)
+{
+	// Leaves have no children, so we leave out the room for them
+	size_t size = sizeof(TBTreeNode) + (leaf ? 0 : BTREE_ORDER * sizeof(TBTreeNode *));
+	TBTreeNode *node = (TBTreeNode *) malloc(size);
+
+	node->leaf = leaf;
+	node->count = 0;
+	node->next = NULL;
+
+	if (leaf)
+		tree->leaves++;
+	else
+		tree->inners++;
+
+	return node;
+}
+
+static void freeNode(TBTree *tree, TBTreeNode *node)
+{
+	if (node->leaf)
+		tree->leaves--;
+	else
+		tree->inners--;
+
+	free(node);
+}
+
+// Frees node and everything below it
+static void freeSubtree(TBTree *tree, TBTreeNode *node)
+{
+	int i;
+
+	if (!node->leaf)
+		for (i=0; i<node->count; i++)
+			freeSubtree(tree, node->children[i]);
+
+	freeNode(tree, node);
+}
+
+void btreeInit(TBTree *tree, TBTreeKey keyOf, TBTreeCompare compare, void *ctx)
+{
+	tree->root = NULL;
+	tree->count = 0;
+	tree->leaves = 0;
+	tree->inners = 0;
+	tree->keyOf = keyOf;
+	tree->compare = compare;
+	tree->ctx = ctx;
+}
+
+void btreeFree(TBTree *tree)
+{
+	if (tree->root != NULL)
+		freeSubtree(tree, tree->root);
+
+	tree->root = NULL;
+	tree->count = 0;
+}
+
+// Returns the position of the first entry in a leaf that is not smaller than
+// (key, rec), or node->count if they all are.
+static int leafPos(TBTree *tree, TBTreeNode *node, const void *key, int rec)
+{
+	int lo = 0, hi = node->count;
+
+	// Binary search. Everything before lo is smaller, and everything from
+	// hi onwards is not.
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if (compareEntry(tree, key, rec, node->recs[mid]) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// Returns which child of an inner node (key, rec) belongs in. That is the
+// last child whose smallest entry is not larger than (key, rec), or the first
+// child if they all are.
+static int childPos(TBTree *tree, TBTreeNode *node, const void *key, int rec)
+{
+	int lo = 1, hi = node->count;
+
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if (compareEntry(tree, key, rec, node->recs[mid]) >= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - 1;
+}
+
+// Puts rec (and child, in an inner node) at position pos of node, moving
+// the entries after it up one place.
+static void insertEntry(TBTreeNode *node, int pos, int rec, TBTreeNode *child)
+{
+	// memmove is like memcpy, but works even when the source and
+	// destination overlap, as they do here.
+	memmove(&node->recs[pos + 1], &node->recs[pos], (node->count - pos) * sizeof(int));
+	node->recs[pos] = rec;
+
+	if (!node->leaf)
+	{
+		memmove(&node->children[pos + 1], &node->children[pos], (node->count - pos) * sizeof(TBTreeNode *));
+		node->children[pos] = child;
+	}
+
+	node->count++;
+}
+
+static void removeEntry(TBTreeNode *node, int pos)
+{
+	memmove(&node->recs[pos], &node->recs[pos + 1], (node->count - pos - 1) * sizeof(int));
+
+	if (!node->leaf)
+		memmove(&node->children[pos], &node->children[pos + 1], (node->count - pos - 1) * sizeof(TBTreeNode *));
+
+	node->count--;
+}
+
+// Copies n entries of from, starting at start, to position at of to
+static void moveEntries(TBTreeNode *to, int at, TBTreeNode *from, int start, int n)
+{
+	memcpy(&to->recs[at], &from->recs[start], n * sizeof(int));
+
+	if (!to->leaf)
+		memcpy(&to->children[at], &from->children[start], n * sizeof(TBTreeNode *));
+}
+
+// Adds rec (and child) at position pos of a full node by splitting it in two.
+// Returns the new node, which holds the upper half.
+static TBTreeNode *splitNode(TBTree *tree, TBTreeNode *node, int pos, int rec, TBTreeNode *child)
+{
+	TBTreeNode *sibling = newNode(tree, node->leaf);
+	int half = BTREE_ORDER / 2;
+
+	moveEntries(sibling, 0, node, half, BTREE_ORDER - half);
+	sibling->count = BTREE_ORDER - half;
+	node->count = half;
+
+	if (node->leaf)
+	{
+		sibling->next = node->next;
+		node->next = sibling;
+	}
+
+	if (pos <= half)
+		insertEntry(node, pos, rec, child);
+	else
+		insertEntry(sibling, pos - half, rec, child);
+
+	return sibling;
+}
+
+// Adds rec to the subtree under node. If node had to be split, returns the
+// new node that holds its upper half, otherwise returns NULL.
+static TBTreeNode *insertBelow(TBTree *tree, TBTreeNode *node, const void *key, int rec)
+{
+	TBTreeNode *child = NULL;
+	int pos;
+
+	if (node->leaf)
+		pos = leafPos(tree, node, key, rec);
+	else
+	{
+		int i = childPos(tree, node, key, rec);
+		TBTreeNode *split = insertBelow(tree, node->children[i], key, rec);
+
+		// rec may be the new smallest entry of the child
+		node->recs[i] = node->children[i]->recs[0];
+
+		if (split == NULL)
+			return NULL;
+
+		// The child was split, so we add the new half after it
+		pos = i + 1;
+		rec = split->recs[0];
+		child = split;
+	}
+
+	if (node->count < BTREE_ORDER)
+	{
+		insertEntry(node, pos, rec, child);
+		return NULL;
+	}
+
+	return splitNode(tree, node, pos, rec, child);
+}
+
+void btreeInsert(TBTree *tree, int rec)
+{
+	if (tree->root == NULL)
+		tree->root = newNode(tree, 1);
+
+	TBTreeNode *split = insertBelow(tree, tree->root, tree->keyOf(tree->ctx, rec), rec);
+
+	// If the root was split, the tree grows one level taller
+	if (split != NULL)
+	{
+		TBTreeNode *root = newNode(tree, 0);
+
+		insertEntry(root, 0, tree->root->recs[0], tree->root);
+		insertEntry(root, 1, split->recs[0], split);
+		tree->root = root;
+	}
+
+	tree->count++;
+}
+
+// Child i of node has fewer than BTREE_MIN entries. If it and a neighbour
+// fit in one node we merge them, otherwise we share their entries out evenly.
+static void rebalance(TBTree *tree, TBTreeNode *node, int i)
+{
+	int l, r;
+
+	if (i + 1 < node->count)
+	{
+		l = i;
+		r = i + 1;
+	}
+	else if (i > 0)
+	{
+		l = i - 1;
+		r = i;
+	}
+	else
+		return;
+
+	TBTreeNode *left = node->children[l];
+	TBTreeNode *right = node->children[r];
+	int total = left->count + right->count;
+
+	if (total <= BTREE_ORDER)
+	{
+		moveEntries(left, left->count, right, 0, right->count);
+		left->count = total;
+		left->next = right->next;
+		freeNode(tree, right);
+		removeEntry(node, r);
+
+		// left may have been empty before
+		node->recs[l] = left->recs[0];
+	}
+	else if (left->count > total / 2)
+	{
+		// Move the end of left to the start of right
+		int n = left->count - total / 2;
+
+		memmove(&right->recs[n], &right->recs[0], right->count * sizeof(int));
+
+		if (!right->leaf)
+			memmove(&right->children[n], &right->children[0], right->count * sizeof(TBTreeNode *));
+
+		moveEntries(right, 0, left, left->count - n, n);
+		left->count -= n;
+		right->count += n;
+		node->recs[r] = right->recs[0];
+	}
+	else
+	{
+		// Move the start of right to the end of left
+		int n = total / 2 - left->count;
+
+		moveEntries(left, left->count, right, 0, n);
+		memmove(&right->recs[0], &right->recs[n], (right->count - n) * sizeof(int));
+
+		if (!right->leaf)
+			memmove(&right->children[0], &right->children[n], (right->count - n) * sizeof(TBTreeNode *));
+
+		left->count += n;
+		right->count -= n;
+		node->recs[r] = right->recs[0];
+	}
+}
+
+// Removes rec from the subtree under node. Returns 1 if it was found.
+static int removeBelow(TBTree *tree, TBTreeNode *node, const void *key, int rec)
+{
+	if (node->leaf)
+	{
+		int pos = leafPos(tree, node, key, rec);
+
+		if (pos >= node->count || node->recs[pos] != rec)
+			return 0;
+
+		removeEntry(node, pos);
+		return 1;
+	}
+
+	int i = childPos(tree, node, key, rec);
+	TBTreeNode *child = node->children[i];
+
+	if (!removeBelow(tree, child, key, rec))
+		return 0;
+
+	// rec may have been the smallest entry of the child. Nodes other than
+	// the root are never empty once rebalance is done with them, so the
+	// inner nodes never keep a record that is no longer in the tree.
+	if (child->count > 0)
+		node->recs[i] = child->recs[0];
+
+	if (child->count < BTREE_MIN)
+		rebalance(tree, node, i);
+
+	return 1;
+}
+
+int btreeRemove(TBTree *tree, int rec)
+{
+	if (tree->root == NULL || !removeBelow(tree, tree->root, tree->keyOf(tree->ctx, rec), rec))
+		return 0;
+
+	// A root with only one child is not needed, so the tree gets shorter
+	while (!tree->root->leaf && tree->root->count == 1)
+	{
+		TBTreeNode *root = tree->root;
+
+		tree->root = root->children[0];
+		freeNode(tree, root);
+	}
+
+	tree->count--;
+	return 1;
+}
+
+// Sorts recs[lo..hi-1] using tmp as scratch space. This is a merge sort:
+// sort each half, then merge the two sorted halves. We write our own
+// instead of using qsort because qsort's compare function cannot be given
+// our tree.
+static void mergeSort(TBTree *tree, int *recs, int *tmp, int lo, int hi)
+{
+	if (hi - lo < 2)
+		return;
+
+	int mid = lo + (hi - lo) / 2;
+	int i = lo, j = mid, k = lo;
+
+	mergeSort(tree, recs, tmp, lo, mid);
+	mergeSort(tree, recs, tmp, mid, hi);
+
+	while (i < mid && j < hi)
+	{
+		if (compareEntry(tree, tree->keyOf(tree->ctx, recs[j]), recs[j], recs[i]) < 0)
+			tmp[k++] = recs[j++];
+		else
+			tmp[k++] = recs[i++];
+	}
+
+	while (i < mid)
+		tmp[k++] = recs[i++];
+
+	while (j < hi)
+		tmp[k++] = recs[j++];
+
+	memcpy(&recs[lo], &tmp[lo], (hi - lo) * sizeof(int));
+}
+
+// Builds one level of the tree from the level below it. For the leaves,
+// recs holds the sorted records and children is NULL. Otherwise children
+// holds the n nodes of the level below. Returns the number of nodes made,
+// which are put in nodes.
+static int buildLevel(TBTree *tree, int *recs, TBTreeNode **children, int n, TBTreeNode **nodes)
+{
+	// Share the entries out evenly, so that the last node is not left with
+	// only a few of them.
+	int numNodes = (n + BTREE_FILL - 1) / BTREE_FILL;
+	int i, j, k = 0;
+
+	for (i=0; i<numNodes; i++)
+	{
+		int size = n / numNodes + (i < n % numNodes);
+
+		nodes[i] = newNode(tree, children == NULL);
+
+		for (j=0; j<size; j++, k++)
+			if (children == NULL)
+				nodes[i]->recs[j] = recs[k];
+			else
+			{
+				nodes[i]->recs[j] = children[k]->recs[0];
+				nodes[i]->children[j] = children[k];
+			}
+
+		nodes[i]->count = size;
+
+		if (children == NULL && i > 0)
+			nodes[i - 1]->next = nodes[i];
+	}
+
+	return numNodes;
+}
+
+void btreeBuild(TBTree *tree, int *recs, int n)
+{
+	btreeFree(tree);
+
+	if (n == 0)
+		return;
+
+	int *sorted = (int *) malloc(n * sizeof(int));
+	int *tmp = (int *) malloc(n * sizeof(int));
+
+	memcpy(sorted, recs, n * sizeof(int));
+	mergeSort(tree, sorted, tmp, 0, n);
+	free(tmp);
+
+	// Each level has at most half as many nodes as there are entries in the
+	// level below, so these two arrays are always big enough.
+	TBTreeNode **level = (TBTreeNode **) malloc(n * sizeof(TBTreeNode *));
+	TBTreeNode **above = (TBTreeNode **) malloc(n * sizeof(TBTreeNode *));
+	int count = buildLevel(tree, sorted, NULL, n, level);
+
+	while (count > 1)
+	{
+		TBTreeNode **swap = level;
+
+		count = buildLevel(tree, NULL, level, count, above);
+		level = above;
+		above = swap;
+	}
+
+	tree->root = level[0];
+	tree->count = n;
+
+	free(sorted);
+	free(level);
+	free(above);
+}
+
+void btreeSeek(TBTree *tree, const void *key, TBTreeCursor *cursor)
+{
+	TBTreeNode *node = tree->root;
+
+	cursor->leaf = NULL;
+	cursor->pos = 0;
+
+	if (node == NULL)
+		return;
+
+	while (!node->leaf)
+		node = node->children[key ? childPos(tree, node, key, -1) : 0];
+
+	cursor->leaf = node;
+	cursor->pos = key ? leafPos(tree, node, key, -1) : 0;
+}
+
+int btreeNext(TBTreeCursor *cursor)
+{
+	// If we are past the end of a leaf, carry on with the next one
+	while (cursor->leaf != NULL && cursor->pos >= cursor->leaf->count)
+	{
+		cursor->leaf = cursor->leaf->next;
+		cursor->pos = 0;
+	}
+
+	if (cursor->leaf == NULL)
+		return -1;
+
+	return cursor->leaf->recs[cursor->pos++];
+}
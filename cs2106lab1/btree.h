@@ -0,0 +1,100 @@
+// This is the header file for a B+-tree index. Like a sorted array, a B+-tree
+// keeps record numbers in the order of their keys, so we can find a key, or
+// the first key that starts with some prefix, and then walk forward through
+// the keys in order. Unlike a sorted array, adding or removing a record only
+// touches a few nodes instead of moving half the array.
+//
+// Every node holds up to BTREE_ORDER entries in one block of memory, so a
+// search reads a handful of nodes from top to bottom rather than jumping all
+// over memory. Only the bottom nodes (the "leaves") hold the records, and each
+// leaf points to the next one, so walking through the keys in order is just a
+// matter of reading the leaves one after another.
+
+#ifndef BTREE
+
+#define BTREE
+
+// Maximum number of entries in a node
+#define BTREE_ORDER		64
+
+// Like the hash index, the B+-tree only stores record numbers. It calls keyOf
+// to get the key of a record, and compare to compare two keys. compare works
+// like strcmp: it returns a negative number, 0 or a positive number if a is
+// smaller than, equal to or larger than b. Records with the same key are kept
+// in order of their record numbers.
+typedef const void *(*TBTreeKey)(void *ctx, int rec);
+typedef int (*TBTreeCompare)(const void *a, const void *b);
+
+// A node. In a leaf, recs holds records in key order. In the other nodes
+// ("inner" nodes) children[i] is the subtree that holds the records from
+// recs[i] onwards, so recs[i] is always the smallest record in children[i].
+// Leaves do not have room for children.
+typedef struct TBTreeNode
+{
+	int leaf;						// 1 if this is a leaf
+	int count;						// Number of entries in use
+	struct TBTreeNode *next;		// Next leaf, or NULL if this is the last one
+	int recs[BTREE_ORDER];
+	struct TBTreeNode *children[];
+} TBTreeNode;
+
+typedef struct
+{
+	TBTreeNode *root;				// NULL if the tree has never had any records
+	int count;						// Number of records in the tree
+	int leaves;						// Number of leaf nodes
+	int inners;						// Number of inner nodes
+	TBTreeKey keyOf;
+	TBTreeCompare compare;
+	void *ctx;						// Passed to keyOf
+} TBTree;
+
+// A position in the tree, for walking through the records in key order.
+// Adding or removing a record can move records between nodes, so a cursor
+// must not be used after the tree changes.
+typedef struct
+{
+	TBTreeNode *leaf;
+	int pos;
+} TBTreeCursor;
+
+// Initializes an empty tree.
+// Pre: tree is uninitialized. keyOf and compare are as described above.
+// Post: tree is empty.
+void btreeInit(TBTree *tree, TBTreeKey keyOf, TBTreeCompare compare, void *ctx);
+
+// Frees a tree.
+// Pre: tree was initialized by btreeInit.
+// Post: Memory used by tree is freed, and tree is empty.
+void btreeFree(TBTree *tree);
+
+// Adds a record.
+// Pre: tree was initialized by btreeInit. rec is not in the tree.
+// Post: rec is in the tree at the right place for its key.
+void btreeInsert(TBTree *tree, int rec);
+
+// Removes a record.
+// Pre: tree was initialized by btreeInit. The key of rec has not changed since it was inserted.
+// Post: rec is no longer in the tree. Returns 1 if rec was found, 0 otherwise.
+int btreeRemove(TBTree *tree, int rec);
+
+// Replaces the contents of the tree with n records, sorting them in one go and
+// building the tree from the bottom up. This is much faster than calling
+// btreeInsert n times.
+// Pre: tree was initialized by btreeInit. recs = array of n different record numbers.
+// Post: tree holds exactly the records in recs.
+void btreeBuild(TBTree *tree, int *recs, int n);
+
+// Finds where a key is, or would be, in the tree.
+// Pre: tree was initialized by btreeInit. key = key to look for, or NULL for the first record.
+// Post: cursor is at the first record whose key is not smaller than key.
+void btreeSeek(TBTree *tree, const void *key, TBTreeCursor *cursor);
+
+// Walks forward through the tree.
+// Pre: cursor was set by btreeSeek and the tree has not changed since.
+// Post: Returns the record at cursor and moves cursor to the next record, or
+// returns -1 if cursor is past the last record.
+int btreeNext(TBTreeCursor *cursor);
+
+// Endif for the #ifndef at the start
+#endif
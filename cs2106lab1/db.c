@@ -7,267 +7,2908 @@
 #include <string.h>
 #include <stdlib.h>
 
+// These headers are for the low level file operations (open, fstat) and
+// memory mapping (mmap) used by the binary file format.
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+
 // We include our own header for db.h so that we have the data structure, enum and
 // function prototypes. Note we use quotes here in the #include, which causes C to
 // search for the header file in the current directory.
 
-#include "db.h"
+#include "db.h"
+#include "hashidx.h"
+#include "btree.h"
+#include "journal.h"
+#include "strscan.h"
+
+
+// We first declare the types that we need to store a phonebook. Everything
+// that belongs to one phonebook lives in a TPhonebookDB structure, defined
+// after these types, so a program can have as many phonebooks as it likes.
+// db.h only gives the name of the structure, so other files can hold a
+// pointer to a phonebook but cannot look inside it. The few variables that
+// are shared by all phonebooks are declared static, which makes them
+// accessible only to db.c.
+
+// A person. Rather than keep every person in a TPhonebook, which has room
+// for a 64 character name even though most names are far shorter, we split
+// people into pieces and keep each piece where it costs least:
+//
+// - records holds what we look at while searching, in 8 bytes per person, so
+//   that a 64 byte cache line holds 8 people instead of less than one.
+// - Names and phone numbers live one after the other in one big block of
+//   memory, the "arena". Each person has an entry with their name, a '\0',
+//   their phone number and another '\0', so an entry takes only as many
+//   bytes as it needs. A record holds the offset of its entry in the arena,
+//   and the length of the name.
+// - Most people share a handful of country codes, so each country code is
+//   kept only once, in countries, and records hold its position there.
+//
+// The record number is simply the position in records, so unlike TPhonebook
+// we do not store it. The functions in db.h still hand out TPhonebook
+// structures, which we fill in from the pieces, see getPerson.
+
+typedef struct
+{
+	unsigned name;				// Offset of the entry in arena
+	unsigned char nameLength;
+	unsigned char deleted;
+	unsigned short country;		// Position of the country code in countries
+} TRecord;
+
+// Smallest arena we ever allocate
+#define MIN_ARENA		1024
+
+// Records keep positions in the country code table in an unsigned short, so
+// there can be at most MAX_COUNTRIES different country codes.
+#define MAX_COUNTRIES	65535
+
+// Several people can share a number (e.g. a family or an office), and if we
+// put them all in phoneIndex, adding and deleting would have to step over all
+// the others. So only one owner of each number is in phoneIndex, and the rest
+// hang off it in a doubly linked list in owners, indexed by record number.
+typedef struct
+{
+	int next;		// Next person with the same number, or -1
+	int prev;		// Previous person with the same number, or -1 if this one is in phoneIndex
+} TOwnerLink;
+
+// compactDB runs by itself when more than this fraction of the slots in use
+// hold deleted records, see setCompactThreshold. We leave small phonebooks
+// alone, because compacting them saves next to nothing.
+#define DEFAULT_COMPACT_RATIO	0.5
+#define COMPACT_MIN_RECORDS		1024
+
+// Doubling always adds at least MIN_GROWTH records, so that a tiny phonebook
+// does not grow 1 record at a time.
+#define MIN_GROWTH		16
+
+// The binary file format. The file starts with this header. After it come
+// the pieces of the database exactly as they are in memory: numRecords
+// records, numCountries country codes and arenaSize bytes of arena. That way
+// the file can be mapped into memory and used as the database directly. The
+// header is 48 bytes long. This keeps the records after it aligned.
+
+#define DB_MAGIC		0x4B424850		// "PHBK" when read as bytes
+#define DB_VERSION		2				// Version 1 stored whole TPhonebook structures
+
+typedef struct
+{
+	unsigned magic;			// Always DB_MAGIC, so we know it is a phonebook
+	unsigned version;		// DB_VERSION when the file was written
+	unsigned recordSize;	// sizeof(TRecord) when the file was written
+	int maxSize;
+	int numRecords;
+	unsigned checksum;		// Checksum of everything after the header, see checksumBytes
+	unsigned generation;	// Journals up to this generation are in the records, 0 if none
+	int numCountries;
+	unsigned arenaSize;
+	unsigned reserved[3];
+} TDBHeader;
+
+// The pieces of a database, as writeBinary needs them. saveDBBinary passes
+// the database itself, and compactJournal passes a copy.
+typedef struct
+{
+	TRecord *records;
+	int numRecords;
+	int maxSize;
+	char (*countries)[C_LENGTH];
+	int numCountries;
+	char *arena;
+	size_t arenaSize;
+} TDBImage;
+
+// Everything the compaction thread needs. The thread gets its own copy of
+// the database so that the phonebook can keep changing while it works.
+typedef struct
+{
+	TPhonebookDB *db;
+	TDBImage image;
+	unsigned generation;
+} TCompactJob;
+
+// Readers in concurrent mode find the arrays through a "view", see
+// setConcurrent and findPersonCopy.
+typedef struct
+{
+	TRecord *records;
+	int maxSize;
+	char *arena;
+	size_t arenaCapacity;
+	char (*countries)[C_LENGTH];
+	int countryCapacity;
+	THashIndex index;
+} TReadView;
+
+typedef struct TRetired
+{
+	void *ptr;
+	size_t mapLength;				// Non-zero if ptr must be munmap'ed instead of freed
+	unsigned long epoch;
+	struct TRetired *next;
+} TRetired;
+
+// Each reader thread gets a slot of its own in every phonebook. The padding
+// puts each slot in its own cache line, so that readers do not fight over
+// cache lines. A slot holds the epoch its reader started in, or 0 when it is
+// not reading.
+#define MAX_READERS		64
+#define CACHE_LINE		64
+
+typedef struct
+{
+	unsigned long epoch;
+	char pad[CACHE_LINE - sizeof(unsigned long)];
+} TReaderSlot;
+
+// Slot numbers are handed out to threads the first time they read any
+// phonebook, and a thread uses the same slot number in every phonebook.
+// That way a thread does not have to remember a slot for each phonebook.
+// When a thread exits, the destructor of readerKey puts its slot number on
+// freeReaders so that the next new thread can use it. Without this a server
+// that starts a thread for every request would run out of slots after
+// MAX_READERS requests. numReaders is the number of slots ever handed out,
+// so reclaimMemory only has to look at those.
+static int numReaders = 0;
+static __thread int readerId = -1;
+
+static int freeReaders[MAX_READERS];
+static int numFreeReaders = 0;
+static pthread_mutex_t readerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t readerKey;
+static pthread_once_t readerOnce = PTHREAD_ONCE_INIT;
+
+// How many times a reader spins while a change is being made before it
+// gives up the CPU to let the writer finish
+#define READ_SPINS		100
+
+// A phonebook
+struct TPhonebookDB
+{
+	// Maximum size of DB, and current number of records
+	int maxSize;
+	int numRecords;
+
+	// The database, see TRecord
+	TRecord *records;
+
+	// The arena. arenaSize bytes of it are in use, out of arenaCapacity. The
+	// entries of deleted people stay in the arena until compactDB, and
+	// arenaWaste counts their bytes.
+	char *arena;
+	size_t arenaSize;
+	size_t arenaCapacity;
+	size_t arenaWaste;
+
+	// The country code table, and a hash index on it so that adding a person
+	// does not have to search the table.
+	char (*countries)[C_LENGTH];
+	int numCountries;
+	int countryCapacity;
+	THashIndex countryIndex;
+
+	// Hash index on the names of all records that are not deleted, so that
+	// findPerson does not have to look at every record.
+	THashIndex nameIndex;
+
+	// B+-tree on the same records, for prefix searches and listings in name order.
+	TBTree nameOrder;
+
+	// Hash index on the country code and phone number of the same records,
+	// so that findNumber can tell who owns a number without looking at every
+	// record. People who share a number with the one in the index are in
+	// owners, see TOwnerLink.
+	THashIndex phoneIndex;
+	TOwnerLink *owners;
+	int ownerCapacity;
+
+	// Slots of deleted records. addPerson reuses these before it takes a new
+	// slot, so a phonebook with as many deletes as adds does not keep growing.
+	int *freeSlots;
+	int numFree;
+	int freeCapacity;
+
+	// See setCompactThreshold
+	double compactRatio;
+
+	// How addPerson grows a full phonebook, see setGrowthPolicy. growthStep is
+	// the number of records GROW_FIXED adds each time.
+	int growthPolicy;
+	int growthStep;
+	int numGrowths;
+
+	// Set when the indexes do not match the records yet. loadDBBinary sets it
+	// so that opening a file does not have to read every record. The indexes
+	// are then built the first time we need them.
+	int indexStale;
+
+	// If the database was loaded by loadDBBinary, it lives inside a memory
+	// mapping of the file that starts at mapBase and is mapLength bytes long.
+	// Otherwise mapBase is NULL and the database was allocated with calloc.
+	// The pieces cannot grow inside the mapping, so anything that adds to them
+	// first copies the database out, see unmapDatabase.
+	char *mapBase;
+	size_t mapLength;
+
+	// Journaling, see recoverDB. While journaling is on, every change to the
+	// phonebook is appended to the file journalBase.<generation>.
+	int journaling;
+	TJournal journal;
+	char journalBase[256];
+	char snapshotName[256];
+
+	// Background compaction, see compactJournal
+	pthread_t compactThread;
+	int compacting;
+	int compactResult;
+
+	// Background save, see saveDBBackground. savePid is the process doing
+	// the save, or 0 if none is running.
+	pid_t savePid;
+	int saveResult;
+
+	// Concurrent mode, see setConcurrent. Writers (addPerson, deletePerson and
+	// so on) take writeLock, so only one of them runs at a time. Readers
+	// (findPersonCopy) take no lock at all. Instead they use a "sequence lock":
+	// a writer makes writeSeq odd before it changes anything and even again
+	// when it is done. A reader notes writeSeq before it starts, and if writeSeq
+	// is odd or has changed by the time it finishes, it saw a half-done change
+	// and simply tries again. Since readers never write to anything shared,
+	// they do not slow each other down.
+	int concurrent;
+	pthread_mutex_t writeLock;
+	int writeDepth;				// Writers can call other writers, e.g. deletePerson calls compactDB
+	unsigned long writeSeq;
+
+	// A retry is not enough if the writer has freed memory the reader is
+	// looking at, e.g. because the database or the name index grew. So readers
+	// find the arrays through readView, and arrays (and old views) are not freed
+	// until no reader can still be using them. Every reader announces the epoch
+	// it started in, and memory retired in an earlier epoch than every active
+	// reader is safe to free. This is called "epoch based reclamation".
+	TReadView *readView;
+	TRetired *pendingFree;		// Retired by the writer that is running now
+	TRetired *retired;			// Waiting for readers to move on
+	unsigned long globalEpoch;
+	TReaderSlot readerSlots[MAX_READERS] __attribute__((aligned(CACHE_LINE)));
+};
+
+// Frees memory that readers might still be looking at. Outside concurrent
+// mode nobody else can be looking, so we free it straight away.
+static void retireMemory(TPhonebookDB *db, void *ptr, size_t length)
+{
+	if (ptr == NULL)
+		return;
+
+	if (!db->concurrent)
+	{
+		if (length > 0)
+			munmap(ptr, length);
+		else
+			free(ptr);
+
+		return;
+	}
+
+	TRetired *item = (TRetired *) malloc(sizeof(TRetired));
+
+	item->ptr = ptr;
+	item->mapLength = length;
+	item->next = db->pendingFree;
+	db->pendingFree = item;
+}
+
+// Release function for nameIndex
+static void retireSlots(void *ctx, void *ptr)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	retireMemory(db, ptr, 0);
+}
+
+static void initNameIndex(TPhonebookDB *db, int expected)
+{
+	hashInit(&db->nameIndex, expected);
+	db->nameIndex.release = retireSlots;
+	db->nameIndex.releaseCtx = db;
+}
+
+// Publishes a new view if the database or name index arrays have moved.
+static void publishView(TPhonebookDB *db)
+{
+	TReadView *old = db->readView;
+
+	if (old != NULL && old->records == db->records && old->maxSize == db->maxSize && old->arena == db->arena && old->arenaCapacity == db->arenaCapacity &&
+		old->countries == db->countries && old->countryCapacity == db->countryCapacity &&
+		old->index.recs == db->nameIndex.recs && old->index.capacity == db->nameIndex.capacity)
+		return;
+
+	TReadView *view = (TReadView *) malloc(sizeof(TReadView));
+
+	view->records = db->records;
+	view->maxSize = db->maxSize;
+	view->arena = db->arena;
+	view->arenaCapacity = db->arenaCapacity;
+	view->countries = db->countries;
+	view->countryCapacity = db->countryCapacity;
+	view->index = db->nameIndex;
+
+	__atomic_store_n(&db->readView, view, __ATOMIC_SEQ_CST);
+	retireMemory(db, old, 0);
+}
+
+// Called when a thread that has a reader slot exits. value is the slot
+// number plus one, because the destructor is not called for NULL.
+static void releaseReader(void *value)
+{
+	pthread_mutex_lock(&readerLock);
+	freeReaders[numFreeReaders++] = (int) (intptr_t) value - 1;
+	pthread_mutex_unlock(&readerLock);
+}
+
+static void makeReaderKey()
+{
+	pthread_key_create(&readerKey, releaseReader);
+}
+
+// Gives this thread a reader slot if it does not have one yet. Returns the
+// slot number, or -1 if all MAX_READERS slots are in use by live threads.
+static int claimReader()
+{
+	if (readerId >= 0)
+		return readerId;
+
+	pthread_once(&readerOnce, makeReaderKey);
+	pthread_mutex_lock(&readerLock);
+
+	if (numFreeReaders > 0)
+		readerId = freeReaders[--numFreeReaders];
+	else if (numReaders < MAX_READERS)
+	{
+		readerId = numReaders;
+		__atomic_store_n(&numReaders, numReaders + 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&readerLock);
+
+	if (readerId >= 0)
+		pthread_setspecific(readerKey, (void *) (intptr_t) (readerId + 1));
+
+	return readerId;
+}
+
+// Frees retired memory that no reader can be using any more. With force
+// set everything is freed, which is only safe when there are no readers.
+static void reclaimMemory(TPhonebookDB *db, int force)
+{
+	unsigned long oldest = ~0UL;
+	TRetired **link = &db->retired;
+	int i;
+
+	for (i=0; i<__atomic_load_n(&numReaders, __ATOMIC_ACQUIRE); i++)
+	{
+		unsigned long epoch = __atomic_load_n(&db->readerSlots[i].epoch, __ATOMIC_SEQ_CST);
+
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	while (*link != NULL)
+	{
+		TRetired *item = *link;
+
+		if (force || item->epoch < oldest)
+		{
+			*link = item->next;
+
+			if (item->mapLength > 0)
+				munmap(item->ptr, item->mapLength);
+			else
+				free(item->ptr);
+
+			free(item);
+		}
+		else
+			link = &item->next;
+	}
+}
+
+// Every function that changes the phonebook starts with beginWrite and
+// ends with endWrite. Outside concurrent mode they do nothing.
+static void beginWrite(TPhonebookDB *db)
+{
+	if (!db->concurrent)
+		return;
+
+	pthread_mutex_lock(&db->writeLock);
+
+	if (db->writeDepth++ == 0)
+	{
+		__atomic_store_n(&db->writeSeq, db->writeSeq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+}
+
+static void endWrite(TPhonebookDB *db)
+{
+	if (!db->concurrent)
+		return;
+
+	if (--db->writeDepth == 0)
+	{
+		publishView(db);
+		__atomic_store_n(&db->writeSeq, db->writeSeq + 1, __ATOMIC_RELEASE);
+
+		// Readers that start from now on can only see the new view, so
+		// memory retired by this writer is tagged with the epoch before
+		// the increment.
+		unsigned long epoch = __atomic_fetch_add(&db->globalEpoch, 1, __ATOMIC_SEQ_CST);
+
+		while (db->pendingFree != NULL)
+		{
+			TRetired *item = db->pendingFree;
+
+			db->pendingFree = item->next;
+			item->epoch = epoch;
+			item->next = db->retired;
+			db->retired = item;
+		}
+
+		reclaimMemory(db, 0);
+	}
+
+	pthread_mutex_unlock(&db->writeLock);
+}
+
+// What we search nameIndex for. Knowing the length lets us skip most names
+// without comparing a single character.
+typedef struct
+{
+	const char *name;
+	int length;
+} TNameKey;
+
+// Match function for nameIndex. key is the TNameKey we are looking for.
+static int matchName(void *ctx, int rec, const void *key)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	const TNameKey *nameKey = (const TNameKey *) key;
+
+	return db->records[rec].nameLength == nameKey->length &&
+		memcmp(db->arena + db->records[rec].name, nameKey->name, nameKey->length) == 0;
+}
+
+// Match function for countryIndex. key is the country code we are looking for.
+static int matchCountry(void *ctx, int pos, const void *key)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	return strncmp(db->countries[pos], (const char *) key, C_LENGTH) == 0;
+}
+
+// What we search phoneIndex for. Country codes are interned, so we compare
+// their positions in countries rather than the codes themselves.
+typedef struct
+{
+	int country;
+	const char *phoneNumber;
+} TPhoneKey;
+
+// Key and compare functions for nameOrder
+static const void *nameOf(void *ctx, int rec)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	return db->arena + db->records[rec].name;
+}
+
+// The phone number of record rec, which comes right after the name
+static char *phoneOf(TPhonebookDB *db, int rec)
+{
+	return db->arena + db->records[rec].name + db->records[rec].nameLength + 1;
+}
+
+// Number of bytes record rec takes in the arena
+static size_t entrySize(TPhonebookDB *db, int rec)
+{
+	return db->records[rec].nameLength + strlen(phoneOf(db, rec)) + 2;
+}
+
+// Match function for phoneIndex. key is the TPhoneKey we are looking for.
+static int matchPhone(void *ctx, int rec, const void *key)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	const TPhoneKey *phoneKey = (const TPhoneKey *) key;
+
+	return db->records[rec].country == phoneKey->country &&
+		strcmp(phoneOf(db, rec), phoneKey->phoneNumber) == 0;
+}
+
+// Hash value of a country position and phone number for phoneIndex. We mix
+// the country into the hash of the number, so the same number in different
+// countries usually lands in different slots.
+static unsigned hashPhone(int country, const char *phoneNumber)
+{
+	return hashString(phoneNumber) ^ ((unsigned) country * 2654435761u);
+}
+
+static int compareNames(const void *a, const void *b)
+{
+	return strcmp((const char *) a, (const char *) b);
+}
+
+// Match function for readers in concurrent mode. ctx is the reader's view.
+// The record may be changing under us, so we check that rec is in range and
+// never read past the end of the name.
+static int matchViewName(void *ctx, int rec, const void *key)
+{
+	TReadView *view = (TReadView *) ctx;
+	const TNameKey *nameKey = (const TNameKey *) key;
+
+	if (rec < 0 || rec >= view->maxSize)
+		return 0;
+
+	TRecord record = view->records[rec];
+
+	return record.nameLength == nameKey->length && record.name + record.nameLength < view->arenaCapacity &&
+		memcmp(view->arena + record.name, nameKey->name, nameKey->length) == 0;
+}
+
+// Copies a string into a field of size bytes, cutting it short if it is too
+// long, and returns its length.
+static int copyField(char *field, const char *line, int size)
+{
+	int len = strlen(line);
+
+	if (len > size - 1)
+		len = size - 1;
+
+	memcpy(field, line, len);
+	field[len] = '\0';
+	return len;
+}
+
+// Fills in a TPhonebook from the pieces of record rec
+static void getPerson(TPhonebookDB *db, int rec, TPhonebook *person)
+{
+	TRecord *record = &db->records[rec];
+
+	person->index = rec;
+	person->deleted = record->deleted;
+	memcpy(person->name, db->arena + record->name, record->nameLength + 1);
+	memcpy(person->countryCode, db->countries[record->country], C_LENGTH);
+	copyField(person->phoneNumber, phoneOf(db, rec), NUM_LENGTH);
+}
+
+// Changes the size of an array from usedBytes to newBytes, keeping the
+// first usedBytes. Returns the new array, or NULL if there is not enough
+// memory, in which case the old array is left alone. In concurrent mode
+// readers may still be looking at the old array, so we cannot let realloc
+// free it. Instead we copy it ourselves and retire the old one.
+static void *resizeArray(TPhonebookDB *db, void *array, size_t usedBytes, size_t newBytes)
+{
+	if (!db->concurrent)
+		return realloc(array, newBytes);
+
+	void *newArray = malloc(newBytes);
+
+	if (newArray != NULL)
+	{
+		// array is NULL if nothing has been allocated yet
+		if (usedBytes > 0)
+			memcpy(newArray, array, usedBytes);
+
+		retireMemory(db, array, 0);
+	}
+
+	return newArray;
+}
+
+// Makes room for at least size bytes in the arena. Returns OK or MAX_REACHED.
+static int reserveArena(TPhonebookDB *db, size_t size)
+{
+	if (size <= db->arenaCapacity)
+		return OK;
+
+	// Offsets into the arena are unsigned, so it cannot pass 4GB
+	if (size > 0xFFFFFFFFu)
+		return MAX_REACHED;
+
+	size_t capacity = db->arenaCapacity ? db->arenaCapacity : MIN_ARENA;
+
+	while (capacity < size)
+		capacity *= 2;
+
+	char *newArena = (char *) resizeArray(db, db->arena, db->arenaSize, capacity);
+
+	if (newArena == NULL)
+		return MAX_REACHED;
+
+	db->arena = newArena;
+	db->arenaCapacity = capacity;
+	return OK;
+}
+
+// Returns the position of a country code in countries, or -1 if it is not
+// there. code must have been cleared with memset before the code was copied
+// into it, so codes compare the same whatever came after the '\0'.
+static int findCountry(TPhonebookDB *db, const char *code)
+{
+	return hashFind(&db->countryIndex, hashString(code), matchCountry, db, code);
+}
+
+// Returns the position of a country code in countries, adding it if it is not
+// there yet, or -1 if the table is full or there is not enough memory.
+static int internCountry(TPhonebookDB *db, const char *countryCode)
+{
+	char code[C_LENGTH];
+
+	memset(code, 0, C_LENGTH);
+	copyField(code, countryCode, C_LENGTH);
+
+	int pos = findCountry(db, code);
+
+	if (pos >= 0)
+		return pos;
+
+	if (db->numCountries >= MAX_COUNTRIES)
+		return -1;
+
+	if (db->numCountries == db->countryCapacity)
+	{
+		int capacity = db->countryCapacity ? db->countryCapacity * 2 : 16;
+		char (*newCountries)[C_LENGTH] = (char (*)[C_LENGTH]) resizeArray(db, db->countries,
+			db->numCountries * C_LENGTH, capacity * C_LENGTH);
+
+		if (newCountries == NULL)
+			return -1;
+
+		db->countries = newCountries;
+		db->countryCapacity = capacity;
+	}
+
+	memcpy(db->countries[db->numCountries], code, C_LENGTH);
+	hashInsert(&db->countryIndex, hashString(code), db->numCountries);
+	return db->numCountries++;
+}
+
+// Stores a person in slot, adding their entry to the arena. name must be
+// shorter than NAME_LENGTH. Returns OK, or MAX_REACHED if there is not
+// enough memory or too many country codes.
+static int storePerson(TPhonebookDB *db, int slot, const char *name, const char *countryCode, const char *phoneNumber, int deleted)
+{
+	int length = strlen(name);
+	int phoneLength = strnlen(phoneNumber, NUM_LENGTH - 1);
+	int country = internCountry(db, countryCode);
+
+	if (country < 0 || reserveArena(db, db->arenaSize + length + phoneLength + 2) != OK)
+		return MAX_REACHED;
+
+	char *entry = db->arena + db->arenaSize;
+
+	memcpy(entry, name, length + 1);
+	memcpy(entry + length + 1, phoneNumber, phoneLength);
+	entry[length + 1 + phoneLength] = '\0';
+
+	db->records[slot].name = db->arenaSize;
+	db->records[slot].nameLength = length;
+	db->records[slot].deleted = deleted;
+	db->records[slot].country = country;
+	db->arenaSize += length + phoneLength + 2;
+	return OK;
+}
+
+// Copies a database loaded by loadDBBinary out of its mapping, into memory
+// that can grow. Returns OK or MAX_REACHED.
+static int unmapDatabase(TPhonebookDB *db)
+{
+	if (db->mapBase == NULL)
+		return OK;
+
+	size_t arenaBytes = db->arenaSize > MIN_ARENA ? db->arenaSize : MIN_ARENA;
+	int countryBytes = (db->numCountries > 0 ? db->numCountries : 1) * C_LENGTH;
+
+	TRecord *newRecords = (TRecord *) calloc(db->maxSize > 0 ? db->maxSize : 1, sizeof(TRecord));
+	char *newArena = (char *) malloc(arenaBytes);
+	char (*newCountries)[C_LENGTH] = (char (*)[C_LENGTH]) malloc(countryBytes);
+
+	if (newRecords == NULL || newArena == NULL || newCountries == NULL)
+	{
+		free(newRecords);
+		free(newArena);
+		free(newCountries);
+		return MAX_REACHED;
+	}
+
+	memcpy(newRecords, db->records, db->numRecords * sizeof(TRecord));
+	memcpy(newArena, db->arena, db->arenaSize);
+	memcpy(newCountries, db->countries, db->numCountries * C_LENGTH);
+	retireMemory(db, db->mapBase, db->mapLength);
+
+	db->records = newRecords;
+	db->arena = newArena;
+	db->arenaCapacity = arenaBytes;
+	db->countries = newCountries;
+	db->countryCapacity = countryBytes / C_LENGTH;
+	db->mapBase = NULL;
+	db->mapLength = 0;
+	return OK;
+}
+
+// Frees the database and its indexes, whether the database was allocated
+// with calloc or mapped from a binary file.
+static void releaseDatabase(TPhonebookDB *db)
+{
+	if (db->records == NULL)
+		return;
+
+	if (db->mapBase != NULL)
+		retireMemory(db, db->mapBase, db->mapLength);
+	else
+	{
+		retireMemory(db, db->records, 0);
+		retireMemory(db, db->arena, 0);
+		retireMemory(db, db->countries, 0);
+	}
+
+	hashFree(&db->nameIndex);
+	hashFree(&db->countryIndex);
+	hashFree(&db->phoneIndex);
+	btreeFree(&db->nameOrder);
+	free(db->freeSlots);
+	free(db->owners);
+
+	db->records = NULL;
+	db->arena = NULL;
+	db->arenaSize = 0;
+	db->arenaCapacity = 0;
+	db->arenaWaste = 0;
+	db->countries = NULL;
+	db->numCountries = 0;
+	db->countryCapacity = 0;
+	db->freeSlots = NULL;
+	db->numFree = 0;
+	db->freeCapacity = 0;
+	db->owners = NULL;
+	db->ownerCapacity = 0;
+	db->mapBase = NULL;
+	db->mapLength = 0;
+	db->indexStale = 0;
+}
+
+// Adds a slot to the free list, doubling the list when it is full
+static void pushFree(TPhonebookDB *db, int slot)
+{
+	if (db->numFree == db->freeCapacity)
+	{
+		db->freeCapacity = db->freeCapacity ? db->freeCapacity * 2 : 16;
+		db->freeSlots = (int *) realloc(db->freeSlots, db->freeCapacity * sizeof(int));
+	}
+
+	db->freeSlots[db->numFree++] = slot;
+}
+
+// Adds record rec to phoneIndex, or to the list of people who share its number
+static void addOwner(TPhonebookDB *db, int rec)
+{
+	if (rec >= db->ownerCapacity)
+	{
+		int capacity = db->ownerCapacity ? db->ownerCapacity * 2 : 16;
+
+		while (capacity <= rec)
+			capacity *= 2;
+
+		db->owners = (TOwnerLink *) realloc(db->owners, capacity * sizeof(TOwnerLink));
+		db->ownerCapacity = capacity;
+	}
+
+	TPhoneKey key = { db->records[rec].country, phoneOf(db, rec) };
+	unsigned hash = hashPhone(key.country, key.phoneNumber);
+	int first = hashFind(&db->phoneIndex, hash, matchPhone, db, &key);
+
+	db->owners[rec].prev = first;
+
+	if (first < 0)
+	{
+		db->owners[rec].next = -1;
+		hashInsert(&db->phoneIndex, hash, rec);
+	}
+	else
+	{
+		// Slip it in right after the one in the index
+		db->owners[rec].next = db->owners[first].next;
+
+		if (db->owners[first].next >= 0)
+			db->owners[db->owners[first].next].prev = rec;
+
+		db->owners[first].next = rec;
+	}
+}
+
+// Takes record rec out of phoneIndex or the list it is on. If rec was in
+// phoneIndex, the next person with the same number takes its place.
+static void removeOwner(TPhonebookDB *db, int rec)
+{
+	int next = db->owners[rec].next;
+	int prev = db->owners[rec].prev;
+
+	if (prev < 0)
+	{
+		unsigned hash = hashPhone(db->records[rec].country, phoneOf(db, rec));
+
+		hashRemove(&db->phoneIndex, hash, rec);
+
+		if (next >= 0)
+		{
+			db->owners[next].prev = -1;
+			hashInsert(&db->phoneIndex, hash, next);
+		}
+	}
+	else
+	{
+		db->owners[prev].next = next;
+
+		if (next >= 0)
+			db->owners[next].prev = prev;
+	}
+}
+
+// Rebuilds the indexes, the free list and arenaWaste from scratch. If the database
+// has the same name twice, the first one wins, just like a linear search would find.
+static void buildIndexes(TPhonebookDB *db)
+{
+	// We collect the indexed records and sort them all at once at the end.
+	int *indexed = (int *) malloc((db->numRecords > 0 ? db->numRecords : 1) * sizeof(int));
+	int numIndexed = 0;
+
+	hashFree(&db->nameIndex);
+	initNameIndex(db, db->maxSize);
+	db->numFree = 0;
+	db->arenaWaste = 0;
+
+	hashFree(&db->countryIndex);
+	hashInit(&db->countryIndex, db->numCountries);
+	hashFree(&db->phoneIndex);
+	hashInit(&db->phoneIndex, db->maxSize);
+
+	for (int i=0; i<db->numCountries; i++)
+		hashInsert(&db->countryIndex, hashString(db->countries[i]), i);
+
+	// Push free slots from the end, so the lowest slots get reused first
+	for (int i=db->numRecords-1; i>=0; i--)
+		if (db->records[i].deleted)
+		{
+			pushFree(db, i);
+			db->arenaWaste += entrySize(db, i);
+		}
+
+	for (int i=0; i<db->numRecords; i++)
+	{
+		TNameKey key = { db->arena + db->records[i].name, db->records[i].nameLength };
+		unsigned hash = hashString(key.name);
+
+		if (!db->records[i].deleted && hashFind(&db->nameIndex, hash, matchName, db, &key) < 0)
+		{
+			hashInsert(&db->nameIndex, hash, i);
+			addOwner(db, i);
+			indexed[numIndexed++] = i;
+		}
+	}
+
+	btreeBuild(&db->nameOrder, indexed, numIndexed);
+	free(indexed);
+	db->indexStale = 0;
+}
+
+static void ensureIndexes(TPhonebookDB *db)
+{
+	if (db->indexStale)
+		buildIndexes(db);
+}
+
+TPhonebookDB *dbCreate()
+{
+	TPhonebookDB *db;
+
+	// readerSlots must start on a cache line, which malloc does not promise
+	if (posix_memalign((void **) &db, CACHE_LINE, sizeof(TPhonebookDB)) != 0)
+		return NULL;
+
+	// Clearing the whole structure sets every pointer to NULL and every
+	// count to 0, so we only need to set what does not start at 0.
+	memset(db, 0, sizeof(TPhonebookDB));
+	db->compactRatio = DEFAULT_COMPACT_RATIO;
+	db->growthPolicy = GROW_DOUBLE;
+	db->growthStep = MIN_GROWTH;
+	db->compactResult = OK;
+	db->saveResult = OK;
+	db->globalEpoch = 1;
+	return db;
+}
+
+void dbInitPhonebook(TPhonebookDB *db, int maxRecords)
+{
+
+	// The records variable was initialized to be NULL. If it isn't NULL
+	// It had previously been initialized. We free the memory from the 
+	// previous initialization.
+	releaseDatabase(db);
+
+	// Maintain maximum size of phonebook, and initialize number of 
+	// records to 0.
+	db->maxSize = maxRecords;
+	db->numRecords = 0;
+	db->numGrowths = 0;
+
+	// Call calloc to allocate memory for phonebook. "Calloc" is different from malloc
+	// because it lets you specify the number of variables to create, as well as the
+	// size of each variable. calloc also clears the memory it allocates. The arena
+	// and the country code table start empty and grow as people are added.
+	db->records = (TRecord *) calloc(db->maxSize, sizeof(TRecord));
+	initNameIndex(db, db->maxSize);
+	hashInit(&db->countryIndex, 0);
+	hashInit(&db->phoneIndex, db->maxSize);
+	btreeInit(&db->nameOrder, nameOf, compareNames, db);
+}
+
+// Looks for a person and returns their record number, or -1 if they are not there.
+static int findRecord(TPhonebookDB *db, char *name)
+{
+	char key[NAME_LENGTH];
+
+	if (db->records == NULL)
+		return -1;
+
+	ensureIndexes(db);
+
+	// Names longer than NAME_LENGTH - 1 are cut short when they are added,
+	// so we do the same here.
+	TNameKey nameKey = { key, copyField(key, name, NAME_LENGTH) };
+
+	// Deleted records are not in the index, so we do not have to check
+	// the deleted flag here.
+	return hashFind(&db->nameIndex, hashString(key), matchName, db, &nameKey);
+}
+
+// Does the work of addPerson for a name that has already been cut down to
+// NAME_LENGTH - 1 characters, and whose hash value is hash. Returns OK,
+// MAX_REACHED or DUPLICATE, and on OK puts the new record number in slot.
+// Adding the record to nameOrder is left to the caller. The caller must have
+// called beginWrite and ensureIndexes.
+static int insertPerson(TPhonebookDB *db, char *key, unsigned hash, char *countryCode, char *phoneNumber, int *slot)
+{
+	TNameKey nameKey = { key, (int) strlen(key) };
+
+	// Check for a duplicate first, so that adding someone who is already
+	// there never grows the phonebook, and is never refused as MAX_REACHED.
+	if (hashFind(&db->nameIndex, hash, matchName, db, &nameKey) >= 0)
+		return DUPLICATE;
+
+	// If the phonebook is full, grow it if the growth policy allows.
+	if (unmapDatabase(db) != OK || (db->numFree == 0 && db->numRecords >= db->maxSize && dbGrowDB(db) != OK))
+		return MAX_REACHED;
+
+	// Reuse the slot of a deleted record if there is one, otherwise
+	// take the next unused slot.
+	*slot = (db->numFree > 0) ? db->freeSlots[db->numFree - 1] : db->numRecords;
+
+	if (storePerson(db, *slot, key, countryCode, phoneNumber, 0) != OK)
+		return MAX_REACHED;
+
+	if (db->numFree > 0)
+		db->numFree--;
+	else
+		db->numRecords++;
+
+	// Add the new record to the hash indexes
+	hashInsert(&db->nameIndex, hash, *slot);
+	addOwner(db, *slot);
+
+	if (db->journaling)
+		journalAppend(&db->journal, JOURNAL_ADD, key,
+			db->countries[db->records[*slot].country], phoneOf(db, *slot));
+
+	return OK;
+}
+
+void dbAddPerson(TPhonebookDB *db, char *name, char *countryCode, char *phoneNumber, int *result)
+{
+	// Check if we have reached the maximum size of this phonebook. If so we return MAX_REACHED
+	// in result. Note because result is defined as a pointer, we use "*" to dereference.
+	// This is called "call by pointer" and it allows us to return values in a parameter.
+	// By default all C parameters are "call by value", which prevents us from changing
+	// the value of an argument permanently.
+	// The free list is only up to date once the indexes are, see buildIndexes.
+	beginWrite(db);
+	ensureIndexes(db);
+
+	// We use copyField to copy strings because C does not allow assignment of
+	// strings with "=". copyField lets us specify the maximum number of characters
+	// to copy, making stack overflow attacks harder.
+	char key[NAME_LENGTH];
+	copyField(key, name, NAME_LENGTH);
+
+	int slot;
+
+	*result = insertPerson(db, key, hashString(key), countryCode, phoneNumber, &slot);
+
+	if (*result == OK)
+		btreeInsert(&db->nameOrder, slot);
+
+	endWrite(db);
+}
+
+// findPerson and findNumber hand out a pointer to this. Every thread has its own.
+static __thread TPhonebook foundPerson;
+
+TPhonebook *dbFindPerson(TPhonebookDB *db, char *name)
+{
+	int rec = findRecord(db, name);
+
+	if (rec < 0)
+		return NULL;
+
+	getPerson(db, rec, &foundPerson);
+	return &foundPerson;
+}
+
+TPhonebook *dbFindNumber(TPhonebookDB *db, char *countryCode, char *phoneNumber)
+{
+	char code[C_LENGTH];
+	char number[NUM_LENGTH];
+
+	if (db->records == NULL)
+		return NULL;
+
+	ensureIndexes(db);
+
+	// Clean up the country code and number the same way storePerson does
+	memset(code, 0, C_LENGTH);
+	copyField(code, countryCode, C_LENGTH);
+	copyField(number, phoneNumber, NUM_LENGTH);
+
+	// If nobody has this country code, nobody has this number either
+	TPhoneKey key = { findCountry(db, code), number };
+
+	if (key.country < 0)
+		return NULL;
+
+	int rec = hashFind(&db->phoneIndex, hashPhone(key.country, number), matchPhone, db, &key);
+
+	if (rec < 0)
+		return NULL;
+
+	getPerson(db, rec, &foundPerson);
+	return &foundPerson;
+}
+
+int dbFindPersonCopy(TPhonebookDB *db, char *name, TPhonebook *person)
+{
+	char key[NAME_LENGTH];
+	unsigned long seq;
+	int rec, spins = 0;
+
+	if (!db->concurrent)
+	{
+		rec = findRecord(db, name);
+
+		if (rec < 0)
+			return CANNOT_FIND;
+
+		getPerson(db, rec, person);
+		return OK;
+	}
+
+	// Give this thread a reader slot the first time it reads. If too many
+	// threads are reading at once we fall back on taking the writer lock.
+	if (claimReader() < 0)
+	{
+		pthread_mutex_lock(&db->writeLock);
+		rec = findRecord(db, name);
+
+		if (rec >= 0)
+			getPerson(db, rec, person);
+
+		pthread_mutex_unlock(&db->writeLock);
+		return (rec >= 0) ? OK : CANNOT_FIND;
+	}
+
+	TReaderSlot *slot = &db->readerSlots[readerId];
+	TNameKey nameKey = { key, copyField(key, name, NAME_LENGTH) };
+	unsigned hash = hashString(key);
+
+	__atomic_store_n(&slot->epoch, __atomic_load_n(&db->globalEpoch, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+
+	do
+	{
+		seq = __atomic_load_n(&db->writeSeq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1)
+		{
+			if (++spins % READ_SPINS == 0)
+				sched_yield();
+
+			continue;
+		}
+
+		TReadView *view = __atomic_load_n(&db->readView, __ATOMIC_SEQ_CST);
+
+		rec = hashFind(&view->index, hash, matchViewName, view, &nameKey);
+
+		// matchViewName has checked rec and the name, but we must not read
+		// past the end of the arena or the country codes either.
+		if (rec >= 0)
+		{
+			TRecord record = view->records[rec];
+			size_t phoneAt = (size_t) record.name + record.nameLength + 1;
+			int i;
+
+			person->index = rec;
+			person->deleted = 0;
+			memcpy(person->name, key, nameKey.length + 1);
+
+			for (i=0; i<NUM_LENGTH - 1 && phoneAt + i < view->arenaCapacity && view->arena[phoneAt + i] != '\0'; i++)
+				person->phoneNumber[i] = view->arena[phoneAt + i];
+
+			person->phoneNumber[i] = '\0';
+
+			if (record.country < view->countryCapacity)
+				memcpy(person->countryCode, view->countries[record.country], C_LENGTH);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&db->writeSeq, __ATOMIC_RELAXED) != seq);
+
+	__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+
+	return (rec >= 0) ? OK : CANNOT_FIND;
+}
+
+int dbSetConcurrent(TPhonebookDB *db, int on)
+{
+	if (on && !db->concurrent)
+	{
+		// A recursive mutex lets a writer call another writer
+		pthread_mutexattr_t attr;
+
+		if (db->records == NULL)
+			return CANNOT_FIND;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&db->writeLock, &attr);
+		pthread_mutexattr_destroy(&attr);
+
+		// Readers cannot build the indexes, so we do it now. The database
+		// also has to be out of its mapping, since it moves when it grows.
+		ensureIndexes(db);
+
+		if (unmapDatabase(db) != OK)
+			return MAX_REACHED;
+
+		db->concurrent = 1;
+		publishView(db);
+	}
+	else if (!on && db->concurrent)
+	{
+		// No readers are left, so everything retired can go
+		db->concurrent = 0;
+		retireMemory(db, db->readView, 0);
+		db->readView = NULL;
+
+		while (db->pendingFree != NULL)
+		{
+			TRetired *item = db->pendingFree;
+
+			db->pendingFree = item->next;
+			item->next = db->retired;
+			db->retired = item;
+		}
+
+		reclaimMemory(db, 1);
+		pthread_mutex_destroy(&db->writeLock);
+	}
+
+	return OK;
+}
+
+int dbFindPrefix(TPhonebookDB *db, char *prefix, TPhonebook *results, int k)
+{
+	int len = strlen(prefix);
+	int found = 0, rec;
+	TBTreeCursor cursor;
+
+	if (db->records == NULL)
+		return 0;
+
+	ensureIndexes(db);
+
+	// Names that start with prefix are all together in nameOrder, starting
+	// from the first name that is not smaller than prefix.
+	btreeSeek(&db->nameOrder, prefix, &cursor);
+
+	while (found < k && (rec = btreeNext(&cursor)) >= 0)
+	{
+		if (strncmp(db->arena + db->records[rec].name, prefix, len) != 0)
+			break;
+
+		getPerson(db, rec, &results[found++]);
+	}
+
+	return found;
+}
+
+// findContaining only gives a thread of its own to at least this many records.
+// Starting a thread costs about as much as scanning a few thousand names, so
+// for small phonebooks one thread is quicker.
+#define SEARCH_PER_THREAD	(1 << 16)
+
+// The records one thread of findContaining scans, and what it found there
+typedef struct
+{
+	TPhonebookDB *db;
+	const TScanPattern *pattern;
+	int from;					// First record to scan
+	int to;						// Record to stop before
+	int *recs;					// The first k matches
+	int k;
+	int found;					// Number of matches, which can be more than k
+} TSearchPart;
+
+static void *searchMain(void *arg)
+{
+	TSearchPart *part = (TSearchPart *) arg;
+	TPhonebookDB *db = part->db;
+	const char *limit = db->arena + db->arenaCapacity;
+	int rec;
+
+	part->found = 0;
+
+	for (rec=part->from; rec<part->to; rec++)
+	{
+		TRecord record = db->records[rec];
+
+		// Name lengths are in records, so names that are too short are
+		// skipped without reading the arena at all.
+		if (record.deleted || record.nameLength < part->pattern->length)
+			continue;
+
+		if (scanMatch(part->pattern, db->arena + record.name, record.nameLength, limit))
+		{
+			if (part->found < part->k)
+				part->recs[part->found] = rec;
+
+			part->found++;
+		}
+	}
+
+	return NULL;
+}
+
+int dbFindContaining(TPhonebookDB *db, char *text, int ignoreCase, TPhonebook *results, int k)
+{
+	TScanPattern pattern;
+	int i, j, numStarted, found = 0, filled = 0, numRecs = 0;
+
+	if (db->records == NULL || scanInit(&pattern, text, ignoreCase) != 0)
+		return 0;
+
+	// Split the records evenly between one thread per CPU, as long as each
+	// gets enough of them to be worth it.
+	int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (numThreads > db->numRecords / SEARCH_PER_THREAD)
+		numThreads = db->numRecords / SEARCH_PER_THREAD;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	TSearchPart *parts = (TSearchPart *) malloc(numThreads * sizeof(TSearchPart));
+	pthread_t *threads = (pthread_t *) malloc(numThreads * sizeof(pthread_t));
+
+	for (i=0; i<numThreads && parts != NULL; i++)
+	{
+		parts[i].db = db;
+		parts[i].pattern = &pattern;
+		parts[i].from = (long) db->numRecords * i / numThreads;
+		parts[i].to = (long) db->numRecords * (i + 1) / numThreads;
+		parts[i].k = k < parts[i].to - parts[i].from ? k : parts[i].to - parts[i].from;
+		numRecs += parts[i].k;
+	}
+
+	int *recs = (int *) malloc((numRecs > 0 ? numRecs : 1) * sizeof(int));
+
+	if (parts == NULL || threads == NULL || recs == NULL)
+	{
+		free(parts);
+		free(threads);
+		free(recs);
+		scanFree(&pattern);
+		return 0;
+	}
+
+	for (i=0, numRecs=0; i<numThreads; i++)
+	{
+		parts[i].recs = recs + numRecs;
+		numRecs += parts[i].k;
+	}
+
+	// The calling thread scans the first part itself. If we cannot start
+	// a thread, we scan its part ourselves too.
+	for (numStarted=1; numStarted<numThreads; numStarted++)
+		if (pthread_create(&threads[numStarted], NULL, searchMain, &parts[numStarted]) != 0)
+			break;
+
+	searchMain(&parts[0]);
+
+	for (i=numStarted; i<numThreads; i++)
+		searchMain(&parts[i]);
+
+	for (i=1; i<numStarted; i++)
+		pthread_join(threads[i], NULL);
+
+	// The parts are in record order, so the first k matches overall are
+	// among the first k of each part.
+	for (i=0; i<numThreads; i++)
+	{
+		for (j=0; j<parts[i].found && j<parts[i].k && filled<k; j++)
+			getPerson(db, parts[i].recs[j], &results[filled++]);
+
+		found += parts[i].found;
+	}
+
+	free(parts);
+	free(threads);
+	free(recs);
+	scanFree(&pattern);
+	return found;
+}
+
+void startListing(TListCursor *cursor, char *from, char *to)
+{
+	copyField(cursor->from, from != NULL ? from : "", NAME_LENGTH);
+	copyField(cursor->to, to != NULL ? to : "", NAME_LENGTH);
+	cursor->skipFrom = 0;
+}
+
+int dbNextListing(TPhonebookDB *db, TListCursor *cursor, TPhonebook *results, int k)
+{
+	int found = 0, rec;
+	TBTreeCursor pos;
+
+	if (db->records == NULL)
+		return 0;
+
+	ensureIndexes(db);
+
+	// We start from the name where the last page ended rather than keep a
+	// position in the tree, so pages are right even if the phonebook
+	// changed in between. Finding that name again costs only O(log n).
+	btreeSeek(&db->nameOrder, cursor->from, &pos);
+
+	while (found < k && (rec = btreeNext(&pos)) >= 0)
+	{
+		char *name = db->arena + db->records[rec].name;
+
+		// The last page already had this one
+		if (cursor->skipFrom && strcmp(name, cursor->from) == 0)
+			continue;
+
+		if (cursor->to[0] != '\0' && strcmp(name, cursor->to) >= 0)
+			break;
+
+		getPerson(db, rec, &results[found++]);
+	}
+
+	if (found > 0)
+	{
+		copyField(cursor->from, results[found - 1].name, NAME_LENGTH);
+		cursor->skipFrom = 1;
+	}
+
+	return found;
+}
+
+void dbListPhonebook(TPhonebookDB *db)
+{
+	printf("\nPHONE LISTING\n");
+	printf(  "=============\n\n");
+
+	// Check first if database is initialized.
+	if (db->records != NULL)
+	{
+		TBTreeCursor cursor;
+		int rec;
+
+		ensureIndexes(db);
+
+		// Walk through nameOrder, which has every record that is not marked
+		// "deleted", and print the details in name order.
+		btreeSeek(&db->nameOrder, NULL, &cursor);
+
+		while ((rec = btreeNext(&cursor)) >= 0)
+			printf("%d: %s (%s)-(%s)\n", rec+1, db->arena + db->records[rec].name, db->countries[db->records[rec].country], phoneOf(db, rec));
+	}
+	else
+		printf("*** EMPTY ***\n\n");
+}
+
+int dbDeletePerson(TPhonebookDB *db, char *name)
+{
+	beginWrite(db);
+
+	// We reuse the findRecord function to locate the person we want to delete.
+	int rec = findRecord(db, name);
+
+	// If findRecord returns -1, it means that we cannot find this person
+	// in the phonebook. We return CANNOT_FIND. Note we could have used a "results"
+	// parameter like in addPerson, but we just want to try something new.
+	if (rec < 0)
+	{
+		endWrite(db);
+		return CANNOT_FIND;
+	}
+	else
+	{
+		// If found, take it out of the indexes, set the deleted flag to
+		// true and return OK. Its entry stays in the arena until compactDB.
+		// Note that we really should implement an undelete function.
+		char *personName = db->arena + db->records[rec].name;
+
+		hashRemove(&db->nameIndex, hashString(personName), rec);
+		removeOwner(db, rec);
+		btreeRemove(&db->nameOrder, rec);
+		db->records[rec].deleted = 1;
+		db->arenaWaste += entrySize(db, rec);
+		pushFree(db, rec);
+
+		if (db->journaling)
+			journalAppend(&db->journal, JOURNAL_DELETE, personName, NULL, NULL);
+
+		// Squeeze out the deleted records if there are too many of them, or
+		// too much of the arena is taken by their entries
+		if (db->compactRatio > 0 && db->numRecords >= COMPACT_MIN_RECORDS &&
+			(db->numFree > db->compactRatio * db->numRecords || db->arenaWaste > db->compactRatio * db->arenaSize))
+			dbCompactDB(db);
+
+		endWrite(db);
+		return OK;
+	}
+}
+
+int dbSaveDB(TPhonebookDB *db, char *filename)
+{
+	// We write to a temporary file and rename it to filename once it is
+	// complete. See saveDBBinary for why.
+	char tmpName[256];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", filename);
+
+	// This is how you open a file. The "w" parameter means we open only for
+	// writing. fopen returns a pointer to a structure of type FILE, which
+	// contains important information like where we are currently in a file.
+	FILE *fp = fopen(tmpName, "w");
+
+	// fopen returns NULL if there's been an error.
+	if (fp != NULL)
+	{
+		// Write the maximum size of the phonebook and current number of
+		// non empty records.
+		fprintf(fp, "%d %d\n", db->maxSize, db->numRecords);
+
+		// Go over all records and store everything. We also store deleted records.
+		for (int i=0; i<db->numRecords; i++)
+			fprintf(fp, "%d\n%d\n%s\n%s\n%s\n", i, db->records[i].deleted, db->arena + db->records[i].name,
+				db->countries[db->records[i].country], phoneOf(db, i));
+
+		if (fclose(fp) != 0 || rename(tmpName, filename) != 0)
+		{
+			unlink(tmpName);
+			return SAVE_FAIL;
+		}
+
+		return OK;
+	}
+	else
+		return SAVE_FAIL;
+}
+
+// loadDB reads the file in blocks of this many bytes
+#define READ_BLOCK		(1 << 20)
+
+// Minimum time in seconds between two progress messages from loadDB
+#define PROGRESS_INTERVAL	0.5
+
+// Set by setLoadProgress
+static int showProgress = 0;
+
+void setLoadProgress(int on)
+{
+	showProgress = on;
+}
+
+// A line reader. Reading a file a line at a time with fgets or fscanf is slow
+// because every call goes through stdio, so instead we read big blocks of the
+// file into buf with read(), and hand out lines from the block.
+typedef struct
+{
+	int fd;
+	char *buf;
+	size_t start;		// First byte in buf we have not handed out yet
+	size_t end;			// Number of bytes in buf
+	int eof;			// Set once read() returns no more data
+} TLineReader;
+
+// Returns the next line with the newline (and any '\r' before it) removed,
+// or NULL at the end of the file. The line lives in the reader's buffer, so
+// it is only valid until the next call.
+static char *readLine(TLineReader *reader)
+{
+	while (1)
+	{
+		char *line = reader->buf + reader->start;
+		char *nl = (char *) memchr(line, '\n', reader->end - reader->start);
+
+		// If the block has a whole line, or we cannot read any more, hand
+		// out what we have.
+		if (nl != NULL || reader->eof || (reader->start == 0 && reader->end == READ_BLOCK))
+		{
+			if (nl == NULL)
+			{
+				if (reader->start == reader->end)
+					return NULL;
+
+				// Last line without a newline, or a line longer than the
+				// whole buffer. We need room for the '\0', so we drop the
+				// last byte of an overlong line.
+				nl = reader->buf + (reader->end < READ_BLOCK ? reader->end : READ_BLOCK - 1);
+			}
+
+			reader->start = nl - reader->buf + 1;
+
+			if (reader->start > reader->end)
+				reader->start = reader->end;
+
+			if (nl > line && nl[-1] == '\r')
+				nl--;
+
+			*nl = '\0';
+			return line;
+		}
+
+		// Move the partial line to the start of the buffer, and fill up the
+		// rest from the file.
+		memmove(reader->buf, line, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+
+		ssize_t n = read(reader->fd, reader->buf + reader->end, READ_BLOCK - reader->end);
+
+		if (n <= 0)
+			reader->eof = 1;
+		else
+			reader->end += n;
+	}
+}
+
+// Parses a whole line as a number. Returns 1 if successful.
+// We write this ourselves because fscanf and strtol do a lot of work we do
+// not need, like skipping spaces and handling other bases.
+static int parseInt(const char *str, int *value)
+{
+	int sign = 1, result = 0;
+
+	if (*str == '-')
+	{
+		sign = -1;
+		str++;
+	}
+
+	if (*str == '\0')
+		return 0;
+
+	while (*str >= '0' && *str <= '9')
+		result = result * 10 + (*str++ - '0');
+
+	*value = sign * result;
+	return *str == '\0';
+}
+
+static double wallClock()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int dbLoadDB(TPhonebookDB *db, char *filename)
+{
+	TLineReader reader;
+
+	int dbSize, dbRecords;
+
+	// Open the file for reading.
+	reader.fd = open(filename, O_RDONLY);
+
+	if (reader.fd < 0)
+		return LOAD_FAIL;
+
+	reader.buf = (char *) malloc(READ_BLOCK);
+	reader.start = 0;
+	reader.end = 0;
+	reader.eof = 0;
+
+	// Read in the maximum size of the phonebook and # of records including
+	// deleted records. These are on the first line, separated by a space.
+	char *line = readLine(&reader);
+	char *space = line ? strchr(line, ' ') : NULL;
+
+	if (space == NULL)
+	{
+		free(reader.buf);
+		close(reader.fd);
+		return LOAD_FAIL;
+	}
+
+	*space = '\0';
+
+	if (!parseInt(line, &dbSize) || !parseInt(space + 1, &dbRecords) || dbRecords < 0)
+	{
+		free(reader.buf);
+		close(reader.fd);
+		return LOAD_FAIL;
+	}
+
+	printf("Read %d records max DB size is %d\n", dbRecords, dbSize);
+
+	// Make sure there is room for every record in the file
+	if (dbSize < dbRecords)
+		dbSize = dbRecords;
+
+	// Initialize the phonebook. Remember that this will deallocate
+	// any previously initialized phonebooks.
+	dbInitPhonebook(db, dbSize);
+
+	double lastProgress = wallClock();
+	int i, ok = 1;
+
+	// Go over each record. Each one is 5 lines: index, deleted flag, name,
+	// country code and phone number. Names can have spaces in them, which is
+	// why we work with whole lines.
+	for (i=0; i<dbRecords && ok; i++)
+	{
+		char *fields[5];
+		TPhonebook person;
+
+		for (int f=0; f<5 && ok; f++)
+		{
+			// The lines live in the reader's buffer until the next
+			// readLine, so we must use each one before reading the next.
+			fields[f] = readLine(&reader);
+
+			if (fields[f] == NULL)
+				ok = 0;
+			else if (f == 0)
+				ok = parseInt(fields[0], (int *) &person.index);
+			else if (f == 1)
+				ok = parseInt(fields[1], &person.deleted);
+			else if (f == 2)
+				copyField(person.name, fields[2], NAME_LENGTH);
+			else if (f == 3)
+				copyField(person.countryCode, fields[3], C_LENGTH);
+			else
+				copyField(person.phoneNumber, fields[4], NUM_LENGTH);
+		}
+
+		// The record number is where the record is in the file, so we only
+		// check the index field is a number.
+		if (ok && storePerson(db, i, person.name, person.countryCode, person.phoneNumber, person.deleted != 0) != OK)
+			ok = 0;
+
+		// Checking the clock costs time too, so we only do it every 64K records
+		if (showProgress && (i & 0xFFFF) == 0xFFFF && wallClock() - lastProgress >= PROGRESS_INTERVAL)
+		{
+			printf("Loaded %d of %d records\n", i + 1, dbRecords);
+			lastProgress = wallClock();
+		}
+	}
+
+	free(reader.buf);
+	close(reader.fd);
+
+	// Record maximum phonebook size and number of non empty records. If the
+	// file was cut short we keep the records we managed to read.
+	db->maxSize = dbSize;
+	db->numRecords = ok ? dbRecords : i - 1;
+
+	// Index every record that is not deleted.
+	buildIndexes(db);
+
+	if (showProgress)
+		printf("Loaded %d records\n", db->numRecords);
+
+	return ok ? OK : LOAD_FAIL;
+}
+
+// importCSV splits the file into chunks of about this many bytes. Parser
+// threads each take a chunk at a time.
+#define IMPORT_CHUNK	(4 << 20)
+
+// How many chunks each parser thread may get ahead of the merge. This keeps
+// the memory used by parsed rows bounded however big the file is.
+#define IMPORT_AHEAD	2
+
+// How many rows ahead of the one being merged we prefetch the name index
+#define IMPORT_PREFETCH	8
+
+// A row of the CSV file that has been parsed and checked
+typedef struct
+{
+	char name[NAME_LENGTH];
+	char countryCode[C_LENGTH];
+	char phoneNumber[NUM_LENGTH];
+	unsigned hash;				// hashString(name), so the merge does not have to work it out
+} TImportRow;
+
+// A chunk of the file. start and end are set before the parsers start, and
+// the rest is filled in by the thread that parses the chunk.
+typedef struct
+{
+	const char *start;
+	const char *end;
+	TImportRow *rows;
+	int numRows;
+	int numInvalid;
+	int ready;					// Set once the rows are ready to merge
+} TImportChunk;
+
+// What the parser threads and the merge share. lock protects nextChunk,
+// numMerged, stop and the ready flags.
+typedef struct
+{
+	TImportChunk *chunks;
+	int numChunks;
+	int nextChunk;				// Next chunk for a parser to take
+	int numMerged;				// Number of chunks merged so far
+	int maxAhead;				// Most chunks that can be parsed but not merged
+	int stop;					// Set if the merge gives up early
+	pthread_mutex_t lock;
+	pthread_cond_t parsed;		// Signalled when a chunk is ready
+	pthread_cond_t merged;		// Signalled when a chunk has been merged
+	int *added;					// Records added so far, which are not in nameOrder yet
+	int numAdded;
+	int addedCapacity;
+} TImport;
+
+// Reads one field of a CSV line into field, which has room for size bytes,
+// and moves *p past the field and the comma after it. A field can be in
+// double quotes, so that it can have commas in it, and "" inside quotes
+// stands for one ". Spaces around a field are dropped. Returns the length
+// of the field, which is cut short in field if it does not fit.
+static int readCSVField(const char **p, const char *end, char *field, int size)
+{
+	const char *s = *p;
+	int len = 0, kept = 0;
+
+	while (s < end && *s == ' ')
+		s++;
+
+	if (s < end && *s == '"')
+	{
+		for (s++; s < end; s++)
+		{
+			if (*s == '"')
+			{
+				if (s + 1 < end && s[1] == '"')
+					s++;
+				else
+				{
+					s++;
+					break;
+				}
+			}
+
+			if (len++ < size - 1)
+				field[kept++] = *s;
+		}
+
+		while (s < end && *s != ',')
+			s++;
+	}
+	else
+	{
+		for (; s < end && *s != ','; s++)
+			if (len++ < size - 1)
+				field[kept++] = *s;
+
+		// Drop trailing spaces
+		while (kept > 0 && field[kept - 1] == ' ')
+		{
+			kept--;
+			len--;
+		}
+	}
+
+	field[kept] = '\0';
+	*p = (s < end) ? s + 1 : s;
+	return len;
+}
+
+// Removes the spaces and dashes people put in phone numbers, e.g. "9123 4567",
+// and checks that what is left is 1 to maxLength digits. Returns 1 if so.
+static int cleanDigits(char *str, int maxLength)
+{
+	int i, len = 0;
+
+	for (i=0; str[i] != '\0'; i++)
+		if (str[i] >= '0' && str[i] <= '9')
+			str[len++] = str[i];
+		else if (str[i] != ' ' && str[i] != '-')
+			return 0;
+
+	str[len] = '\0';
+	return len > 0 && len <= maxLength;
+}
+
+// Parses and checks one line of the form name,countryCode,phoneNumber.
+// Columns after the third are ignored. Returns 1 if the line is valid.
+static int parseCSVLine(const char *line, const char *end, TImportRow *row)
+{
+	// Room for a few characters more than we keep, so we can tell when a
+	// country code or phone number is too long.
+	char countryCode[16], phoneNumber[32];
+
+	if (readCSVField(&line, end, row->name, NAME_LENGTH) == 0 ||
+		readCSVField(&line, end, countryCode, sizeof(countryCode)) >= (int) sizeof(countryCode) ||
+		readCSVField(&line, end, phoneNumber, sizeof(phoneNumber)) >= (int) sizeof(phoneNumber))
+		return 0;
+
+	// Allow country codes to be written like "+65"
+	char *code = (countryCode[0] == '+') ? countryCode + 1 : countryCode;
+
+	if (!cleanDigits(code, C_LENGTH - 1) || !cleanDigits(phoneNumber, NUM_LENGTH - 1))
+		return 0;
+
+	memcpy(row->countryCode, code, strlen(code) + 1);
+	memcpy(row->phoneNumber, phoneNumber, strlen(phoneNumber) + 1);
+	row->hash = hashString(row->name);
+	return 1;
+}
+
+// Parses every line in a chunk. The first line of the file may be a header
+// with the column names, so if it is not valid we skip it without counting it.
+static void parseChunk(TImportChunk *chunk, int first)
+{
+	const char *line = chunk->start;
+	int capacity = 0;
+
+	chunk->rows = NULL;
+	chunk->numRows = 0;
+	chunk->numInvalid = 0;
+
+	while (line < chunk->end)
+	{
+		const char *next = (const char *) memchr(line, '\n', chunk->end - line);
+		const char *end = next ? next : chunk->end;
+
+		next = next ? next + 1 : chunk->end;
+
+		if (end > line && end[-1] == '\r')
+			end--;
+
+		// Skip blank lines
+		if (end == line)
+		{
+			line = next;
+			continue;
+		}
+
+		if (chunk->numRows == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			chunk->rows = (TImportRow *) realloc(chunk->rows, capacity * sizeof(TImportRow));
+		}
+
+		if (parseCSVLine(line, end, &chunk->rows[chunk->numRows]))
+			chunk->numRows++;
+		else if (!first || line != chunk->start)
+			chunk->numInvalid++;
+
+		line = next;
+	}
+}
+
+// Parser thread. Takes chunks in order until there are none left.
+static void *importMain(void *arg)
+{
+	TImport *import = (TImport *) arg;
+
+	pthread_mutex_lock(&import->lock);
+
+	while (!import->stop && import->nextChunk < import->numChunks)
+	{
+		// Wait for the merge to catch up if we are too far ahead
+		if (import->nextChunk - import->numMerged >= import->maxAhead)
+		{
+			pthread_cond_wait(&import->merged, &import->lock);
+			continue;
+		}
+
+		int i = import->nextChunk++;
+
+		pthread_mutex_unlock(&import->lock);
+		parseChunk(&import->chunks[i], i == 0);
+		pthread_mutex_lock(&import->lock);
+
+		import->chunks[i].ready = 1;
+		pthread_cond_broadcast(&import->parsed);
+	}
+
+	pthread_mutex_unlock(&import->lock);
+	return NULL;
+}
+
+// Adds the rows of a parsed chunk to the phonebook, apart from nameOrder.
+// Returns OK, or MAX_REACHED if the phonebook is full.
+static int mergeChunk(TPhonebookDB *db, TImport *import, TImportChunk *chunk, TImportStats *stats)
+{
+	int i, slot, result = OK;
+
+	// Readers in concurrent mode wait while we write, so we let them in
+	// between chunks rather than holding them up for the whole file.
+	beginWrite(db);
+	ensureIndexes(db);
+
+	for (i=0; i<chunk->numRows && result != MAX_REACHED; i++)
+	{
+		TImportRow *row = &chunk->rows[i];
+
+		// Looking up names in the index mostly waits for memory, so we ask
+		// for the slots of the next few rows while we deal with this one.
+		if (i + IMPORT_PREFETCH < chunk->numRows)
+			hashPrefetch(&db->nameIndex, chunk->rows[i + IMPORT_PREFETCH].hash);
+
+		result = insertPerson(db, row->name, row->hash, row->countryCode, row->phoneNumber, &slot);
+
+		if (result == OK)
+		{
+			if (import->numAdded == import->addedCapacity)
+			{
+				import->addedCapacity = import->addedCapacity ? import->addedCapacity * 2 : 1024;
+				import->added = (int *) realloc(import->added, import->addedCapacity * sizeof(int));
+			}
+
+			import->added[import->numAdded++] = slot;
+			stats->added++;
+		}
+		else if (result == DUPLICATE)
+			stats->duplicates++;
+	}
+
+	stats->invalid += chunk->numInvalid;
+	endWrite(db);
+	return (result == MAX_REACHED) ? MAX_REACHED : OK;
+}
+
+int dbImportCSV(TPhonebookDB *db, char *filename, int numThreads, TImportStats *stats)
+{
+	struct stat st;
+	TImport import;
+	int i, result = OK;
+
+	stats->added = 0;
+	stats->duplicates = 0;
+	stats->invalid = 0;
+
+	if (db->records == NULL)
+		return LOAD_FAIL;
+
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return LOAD_FAIL;
+
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return LOAD_FAIL;
+	}
+
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return OK;
+	}
+
+	// We map the file rather than read it, so the parser threads can all
+	// work on it without copying it around. MADV_SEQUENTIAL asks the kernel
+	// to read well ahead of us, so the disk is kept busy.
+	size_t size = st.st_size;
+	const char *base = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return LOAD_FAIL;
+
+	madvise((void *) base, size, MADV_SEQUENTIAL);
+
+	// Cut the file into chunks that end at the end of a line
+	import.numChunks = 0;
+	import.chunks = (TImportChunk *) malloc((size / IMPORT_CHUNK + 1) * sizeof(TImportChunk));
+
+	for (const char *start = base; start < base + size; import.numChunks++)
+	{
+		const char *end = start + IMPORT_CHUNK;
+
+		if (end >= base + size)
+			end = base + size;
+		else
+		{
+			const char *newline = (const char *) memchr(end, '\n', base + size - end);
+
+			end = newline ? newline + 1 : base + size;
+		}
+
+		import.chunks[import.numChunks].start = start;
+		import.chunks[import.numChunks].end = end;
+		import.chunks[import.numChunks].rows = NULL;
+		import.chunks[import.numChunks].ready = 0;
+		start = end;
+	}
+
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (numThreads > import.numChunks)
+		numThreads = import.numChunks;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	import.nextChunk = 0;
+	import.numMerged = 0;
+	import.maxAhead = numThreads * IMPORT_AHEAD;
+	import.stop = 0;
+	import.added = NULL;
+	import.numAdded = 0;
+	import.addedCapacity = 0;
+	pthread_mutex_init(&import.lock, NULL);
+	pthread_cond_init(&import.parsed, NULL);
+	pthread_cond_init(&import.merged, NULL);
+
+	pthread_t *threads = (pthread_t *) malloc(numThreads * sizeof(pthread_t));
+	int numStarted = 0;
+
+	// We add the new records to nameOrder only at the end, so no other
+	// writer may change the phonebook in between. Readers can still get in
+	// between chunks, see mergeChunk.
+	if (db->concurrent)
+		pthread_mutex_lock(&db->writeLock);
+
+	for (i=0; i<numThreads; i++)
+		if (pthread_create(&threads[numStarted], NULL, importMain, &import) == 0)
+			numStarted++;
+
+	// Merge the chunks in file order, so that if a name appears twice the
+	// first one wins, as it would with addPerson.
+	for (i=0; i<import.numChunks && result == OK; i++)
+	{
+		// If no parser thread would start, we parse each chunk here
+		if (numStarted == 0)
+		{
+			parseChunk(&import.chunks[i], i == 0);
+			import.chunks[i].ready = 1;
+		}
+
+		pthread_mutex_lock(&import.lock);
+
+		while (!import.chunks[i].ready)
+			pthread_cond_wait(&import.parsed, &import.lock);
+
+		pthread_mutex_unlock(&import.lock);
+
+		result = mergeChunk(db, &import, &import.chunks[i], stats);
+		free(import.chunks[i].rows);
+		import.chunks[i].rows = NULL;
+
+		pthread_mutex_lock(&import.lock);
+		import.numMerged++;
+		import.stop = (result != OK);
+		pthread_cond_broadcast(&import.merged);
+		pthread_mutex_unlock(&import.lock);
+	}
+
+	for (i=0; i<numStarted; i++)
+		pthread_join(threads[i], NULL);
+
+	// Inserting into nameOrder one at a time costs O(log n) string compares
+	// each, all over memory. If we added more people than there were before,
+	// building the tree again from scratch is quicker.
+	beginWrite(db);
+
+	if (import.numAdded > db->nameOrder.count)
+	{
+		int *recs = (int *) realloc(import.added, (db->nameOrder.count + import.numAdded) * sizeof(int));
+		TBTreeCursor cursor;
+		int rec;
+
+		btreeSeek(&db->nameOrder, NULL, &cursor);
+
+		while ((rec = btreeNext(&cursor)) >= 0)
+			recs[import.numAdded++] = rec;
+
+		btreeBuild(&db->nameOrder, recs, import.numAdded);
+		import.added = recs;
+	}
+	else
+		for (i=0; i<import.numAdded; i++)
+			btreeInsert(&db->nameOrder, import.added[i]);
 
+	endWrite(db);
 
-// We first declare some variables that we need to store our phonebook.
-// These are not declared in the db.h file, but this does not guarantee that
-// they're not accessible outside of db.c. We can, for example, declare
-// "extern int numRecords;" in another program file, and that will give us
-// access to numRecords in db.c. To prevent this, all variables are declared
-// static, which makes them accessible only to db.c.
+	if (db->concurrent)
+		pthread_mutex_unlock(&db->writeLock);
 
-// Maximum size of DB
-static int maxSize = 0;
+	// If we stopped early, some chunks may have been parsed but not merged
+	for (i=0; i<import.numChunks; i++)
+		free(import.chunks[i].rows);
 
-// Current number of records
-static int numRecords = 0;
+	pthread_mutex_destroy(&import.lock);
+	pthread_cond_destroy(&import.parsed);
+	pthread_cond_destroy(&import.merged);
+	free(threads);
+	free(import.added);
+	free(import.chunks);
+	munmap((void *) base, size);
+	return result;
+}
 
-// The database
-static TPhonebook *database = NULL;
+// Adds bytes to a checksum, so that loadDBBinary can tell if a file is
+// damaged. Start with hash = FNV_START. This is FNV-1a (see hashidx.c), but
+// working on 4 bytes at a time instead of 1, which is 4 times faster and good
+// enough for spotting damage. We memcpy each word because the pieces of the
+// file are not all 4 byte aligned, and the compiler turns that into a plain load.
+#define FNV_START		2166136261u
 
-void initPhonebook(int maxRecords)
+static unsigned checksumBytes(unsigned hash, const void *data, size_t bytes)
 {
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i = 0;
 
-	// The database variable was initialized to be NULL. If it isn't NULL
-	// It had previously been initialized. We free the memory from the 
-	// previous initialization.
-	if (database != NULL)
-		free(database);
+	for (; i + sizeof(unsigned) <= bytes; i += sizeof(unsigned))
+	{
+		unsigned word;
 
-	// Maintain maximum size of phonebook, and initialize number of 
-	// records to 0.
-	maxSize = maxRecords;
-	numRecords = 0;
+		memcpy(&word, p + i, sizeof(unsigned));
+		hash ^= word;
+		hash *= 16777619u;
+	}
 
-	// Call calloc to allocate memory for phonebook. "Calloc" is different from malloc
-	// because it lets you specify the number of variables to create, as well as the
-	// size of each variable. calloc also clears the memory it allocates.
-	database = (TPhonebook *) calloc(maxSize, sizeof(TPhonebook));
+	for (; i < bytes; i++)
+	{
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
 }
 
-void addPerson(char *name, char *countryCode, char *phoneNumber, int *result)
+// Checksum of all the pieces of a database, in the order they are in the file
+static unsigned checksumImage(const TDBImage *image)
 {
-	// Check if we have reached the maximum size of this phonebook. If so we return MAX_REACHED
-	// in result. Note because result is defined as a pointer, we use "*" to dereference.
-	// This is called "call by pointer" and it allows us to return values in a parameter.
-	// By default all C parameters are "call by value", which prevents us from changing
-	// the value of an argument permanently.
-	if (numRecords >= maxSize)
-		*result = MAX_REACHED;
-	else
+	unsigned hash = FNV_START;
+
+	hash = checksumBytes(hash, image->records, (size_t) image->numRecords * sizeof(TRecord));
+	hash = checksumBytes(hash, image->countries, (size_t) image->numCountries * C_LENGTH);
+	return checksumBytes(hash, image->arena, image->arenaSize);
+}
+
+// Checks that every record in a database read from a file points inside it:
+// its entry must fit in the arena, its name must fit in a TPhonebook, and its
+// country code must be in the table. We also check that the arena and every
+// country code end with a '\0', so that reading a phone number or a country
+// code as a string cannot run off the end. Unlike the checksum this only
+// reads the records, so we do it on every load. Returns 1 if all is well.
+static int checkImage(const TDBImage *image)
+{
+	int i;
+
+	if (image->arenaSize > 0 && image->arena[image->arenaSize - 1] != '\0')
+		return 0;
+
+	for (i=0; i<image->numCountries; i++)
+		if (image->countries[i][C_LENGTH - 1] != '\0')
+			return 0;
+
+	for (i=0; i<image->numRecords; i++)
+	{
+		const TRecord *record = &image->records[i];
+
+		// The entry is the name, a '\0', the phone number and another '\0'
+		if (record->nameLength >= NAME_LENGTH ||
+			(size_t) record->name + record->nameLength + 2 > image->arenaSize ||
+			record->country >= image->numCountries)
+			return 0;
+	}
+
+	return 1;
+}
+
+// The database as it is now
+static void currentImage(TPhonebookDB *db, TDBImage *image)
+{
+	image->records = db->records;
+	image->numRecords = db->numRecords;
+	image->maxSize = db->maxSize;
+	image->countries = db->countries;
+	image->numCountries = db->numCountries;
+	image->arena = db->arena;
+	image->arenaSize = db->arenaSize;
+}
+
+// Writes a database in the binary format. This is separate from saveDBBinary
+// so that compaction can write a copy of the database from another thread.
+static int writeBinary(char *filename, const TDBImage *image, unsigned generation)
+{
+	char tmpName[256];
+	TDBHeader header;
+	int n = image->numRecords;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = DB_MAGIC;
+	header.version = DB_VERSION;
+	header.recordSize = sizeof(TRecord);
+	header.maxSize = image->maxSize;
+	header.numRecords = n;
+	header.checksum = checksumImage(image);
+	header.generation = generation;
+	header.numCountries = image->numCountries;
+	header.arenaSize = image->arenaSize;
+
+	// We write to a temporary file and rename it over filename at the end.
+	// rename replaces the file in one step, so a crash never leaves a half
+	// written phonebook. It also matters if our database is mapped from
+	// filename: writing into that file directly would change or cut off
+	// records we have not written out yet.
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", filename);
+
+	FILE *fp = fopen(tmpName, "wb");
+
+	if (fp == NULL)
+		return SAVE_FAIL;
+
+	int ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+	if (ok && n > 0)
+		ok = (fwrite(image->records, sizeof(TRecord), n, fp) == (size_t) n &&
+			fwrite(image->countries, C_LENGTH, image->numCountries, fp) == (size_t) image->numCountries &&
+			fwrite(image->arena, 1, image->arenaSize, fp) == image->arenaSize);
+
+	// A snapshot lets us throw journals away, so it must really be on the
+	// disk before we rename it into place.
+	if (ok && generation > 0)
+		ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+
+	if (fclose(fp) != 0)
+		ok = 0;
+
+	if (!ok || rename(tmpName, filename) != 0)
+	{
+		unlink(tmpName);
+		return SAVE_FAIL;
+	}
+
+	return OK;
+}
+
+int dbSaveDBBinary(TPhonebookDB *db, char *filename)
+{
+	TDBImage image;
+
+	if (db->records == NULL)
+		return SAVE_FAIL;
+
+	currentImage(db, &image);
+	return writeBinary(filename, &image, 0);
+}
+
+int dbSaveDBBackground(TPhonebookDB *db, char *filename, int binary)
+{
+	if (db->records == NULL || dbGetSaveStatus(db) == SAVE_RUNNING)
+		return SAVE_FAIL;
+
+	// fork makes a new process that starts out with the same memory as ours.
+	// The kernel does not copy the memory, but shares it between the two
+	// processes until one of them writes to a page, and only then copies that
+	// page. So the child sees the phonebook exactly as it is now, whatever we
+	// do to it afterwards, and making it costs about the same however big the
+	// phonebook is. Holding the writer lock means the child cannot catch a
+	// change half done in concurrent mode.
+	beginWrite(db);
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		// The child has only this thread, so it must not wait for locks
+		// that other threads held when we forked. Saving takes none. We
+		// leave with _exit rather than exit, so we do not flush stdio
+		// buffers that the parent will flush as well.
+		_exit(binary ? dbSaveDBBinary(db, filename) : dbSaveDB(db, filename));
+	}
+
+	endWrite(db);
+
+	if (pid < 0)
+		return SAVE_FAIL;
+
+	db->savePid = pid;
+	return OK;
+}
+
+// Collects the result of the save process, which has finished with status
+static void finishSave(TPhonebookDB *db, int status)
+{
+	db->saveResult = (WIFEXITED(status) && WEXITSTATUS(status) == OK) ? OK : SAVE_FAIL;
+	db->savePid = 0;
+}
+
+int dbGetSaveStatus(TPhonebookDB *db)
+{
+	int status;
+
+	if (db->savePid > 0)
 	{
-		if (findPerson(name) != NULL)
-			*result = DUPLICATE;
+		pid_t done = waitpid(db->savePid, &status, WNOHANG);
+
+		if (done == 0)
+			return SAVE_RUNNING;
+
+		if (done == db->savePid)
+			finishSave(db, status);
 		else
 		{
-			// We use strncpy to copy strings because C does not allow
-			// assignment of strings with "=". We use strncpy rather than strcpy
-			// because it lets us specify the maximum number of characters to copy,
-			// making stack overflow attacks harder.
-			strncpy(database[numRecords].name, name, NAME_LENGTH);
-			strncpy(database[numRecords].countryCode, countryCode, C_LENGTH);
-			strncpy(database[numRecords].phoneNumber, phoneNumber, NUM_LENGTH);
-
-			// This is the deleted flag
-			database->deleted = 0;
-			database->index = numRecords++;
-			*result = OK;
+			// Someone else collected the process, so we cannot tell
+			// how it went
+			db->saveResult = SAVE_FAIL;
+			db->savePid = 0;
 		}
 	}
+
+	return db->saveResult;
 }
 
-TPhonebook *findPerson(char *name)
+int dbWaitSave(TPhonebookDB *db)
 {
-	int i;
-	int found = 0;
-	TPhonebook *result = NULL;
+	int status;
 
-
-	// Run through every record, or until we find what we want.
-	for (i=0; i<numRecords && !found; i++)
+	if (db->savePid > 0)
 	{
-		// In strcmp if two strings are equal it returns a 0.
-		// This statement sets "found" to be true if strcmp
-		// returns 0.
-		found = (strcmp(name, database[i].name) == 0);
+		pid_t done;
+
+		// A signal can interrupt waitpid before the process is done
+		while ((done = waitpid(db->savePid, &status, 0)) < 0 && errno == EINTR)
+			;
 
-		// We don't count records marked as "deleted".
-		if (found && !database[i].deleted)
-			result = &database[i];
+		if (done == db->savePid)
+			finishSave(db, status);
+		else
+		{
+			db->saveResult = SAVE_FAIL;
+			db->savePid = 0;
+		}
 	}
 
-	return result;
+	return db->saveResult;
 }
 
-void listPhonebook()
+// Loads a binary file, and returns the journal generation it contains in
+// *generation.
+static int mapBinary(TPhonebookDB *db, char *filename, int verify, unsigned *generation)
 {
-	printf("\nPHONE LISTING\n");
-	printf(  "=============\n\n");
+	TDBHeader header;
+	struct stat st;
 
-	// Check first if database is initialized.
-	if (database != NULL)
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return LOAD_FAIL;
+
+	// Check the header before we touch the current phonebook, so that a bad
+	// file leaves it as it was.
+	if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		header.magic != DB_MAGIC || header.version != DB_VERSION ||
+		header.recordSize != sizeof(TRecord) || header.numRecords < 0 ||
+		header.numRecords > header.maxSize || header.numCountries < 0 ||
+		header.numCountries > MAX_COUNTRIES)
 	{
-		int i;
+		close(fd);
+		return LOAD_FAIL;
+	}
 
-		// Go over every record that is not marked "deleted" and print the details.
-		for (i=0; i<numRecords; i++)
-			if (!database[i].deleted)
-				printf("%d: %s (%s)-(%s)\n", i+1, database[i].name, database[i].countryCode, database[i].phoneNumber);
+	// The sizes come from the file, so before we map anything we check that
+	// the file really is long enough to hold them all. Otherwise a truncated
+	// or corrupt file would have us read past the end of the mapping. We add
+	// up in 64 bits so that the sum cannot wrap around, even where size_t is
+	// only 32 bits.
+	unsigned long long needed = sizeof(header) + (unsigned long long) header.numRecords * sizeof(TRecord) +
+		(unsigned long long) header.numCountries * C_LENGTH + header.arenaSize;
+
+	if (needed > (unsigned long long) st.st_size || needed > (size_t) -1)
+	{
+		close(fd);
+		return LOAD_FAIL;
 	}
-	else
-		printf("*** EMPTY ***\n\n");
+
+	// Where each piece starts in the file
+	size_t countriesAt = sizeof(header) + (size_t) header.numRecords * sizeof(TRecord);
+	size_t arenaAt = countriesAt + (size_t) header.numCountries * C_LENGTH;
+	size_t length = arenaAt + header.arenaSize;
+
+	// Map the whole file. MAP_PRIVATE means our changes to the records (e.g.
+	// deleting someone) are never written back to the file. Nothing is read
+	// from the disk until we touch a record, so this is fast even for huge files.
+	char *base = (char *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	// The mapping stays valid after we close the file
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return LOAD_FAIL;
+
+	TDBImage image;
+
+	image.records = (TRecord *) (base + sizeof(header));
+	image.numRecords = header.numRecords;
+	image.maxSize = header.maxSize;
+	image.countries = (char (*)[C_LENGTH]) (base + countriesAt);
+	image.numCountries = header.numCountries;
+	image.arena = base + arenaAt;
+	image.arenaSize = header.arenaSize;
+
+	// Checking the checksum reads the whole file, so it is optional. The
+	// bounds checks are not, because a bad offset would have us read outside
+	// the mapping.
+	if (!checkImage(&image) || (verify && checksumImage(&image) != header.checksum))
+	{
+		munmap(base, length);
+		return LOAD_FAIL;
+	}
+
+	releaseDatabase(db);
+
+	db->records = image.records;
+	db->countries = image.countries;
+	db->numCountries = db->countryCapacity = image.numCountries;
+	db->arena = image.arena;
+	db->arenaSize = db->arenaCapacity = image.arenaSize;
+	db->mapBase = base;
+	db->mapLength = length;
+	db->maxSize = header.maxSize;
+	db->numRecords = header.numRecords;
+
+	initNameIndex(db, 0);
+	hashInit(&db->countryIndex, 0);
+	hashInit(&db->phoneIndex, 0);
+	btreeInit(&db->nameOrder, nameOf, compareNames, db);
+	db->indexStale = 1;
+
+	*generation = header.generation;
+	return OK;
 }
 
-int deletePerson(char *name)
+int dbLoadDBBinary(TPhonebookDB *db, char *filename, int verify)
 {
+	unsigned generation;
 
-	// We reuse the findPerson function to locate the person we want to delete.
-	TPhonebook *result = findPerson(name);
+	return mapBinary(db, filename, verify, &generation);
+}
 
-	// If findPerson returns a NULL, it means that we cannot find this person
-	// in the phonebook. We return CANNOT_FIND. Note we could have used a "results"
-	// parameter like in addPerson, but we just want to try something new.
-	if (result == NULL)
-		return CANNOT_FIND;
-	else
+// Name of the journal file for a generation
+static void journalName(TPhonebookDB *db, char *name, size_t size, unsigned generation)
+{
+	snprintf(name, size, "%s.%u", db->journalBase, generation);
+}
+
+// Applies one journal entry to the phonebook during recovery
+static void applyEntry(void *ctx, TJournalEntry *entry)
+{
+	TPhonebookDB *db = (TPhonebookDB *) ctx;
+
+	int result;
+
+	if (entry->op == JOURNAL_ADD)
 	{
-		// If found, set the deleted flag to true and return OK.
-		// Note that we really should implement an undelete function.
-		result->deleted = 1;
-		return OK;
+		dbAddPerson(db, entry->name, entry->countryCode, entry->phoneNumber, &result);
+
+		// The phonebook may have been resized after the snapshot
+		if (result == MAX_REACHED)
+		{
+			dbResizeDB(db, db->maxSize > 0 ? db->maxSize : 1);
+			dbAddPerson(db, entry->name, entry->countryCode, entry->phoneNumber, &result);
+		}
 	}
+	else if (entry->op == JOURNAL_DELETE)
+		dbDeletePerson(db, entry->name);
 }
 
-int saveDB(char *filename)
+int dbRecoverDB(TPhonebookDB *db, char *snapshotFile, char *journalFile, int groupSize)
 {
-	// This is how you open a file. The "w" parameter means we open only for
-	// writing. fopen returns a pointer to a structure of type FILE, which
-	// contains important information like where we are currently in a file.
-	FILE *fp = fopen(filename, "w");
+	char name[300];
+	unsigned generation = 0;
 
-	// fopen returns NULL if there's been an error.
-	if (fp != NULL)
+	dbCloseJournal(db);
+
+	// A missing snapshot just means we have never compacted, so we start
+	// from the phonebook as it is. A damaged one is an error.
+	if (access(snapshotFile, F_OK) == 0 && mapBinary(db, snapshotFile, 1, &generation) != OK)
+		return LOAD_FAIL;
+
+	if (db->records == NULL)
+		dbInitPhonebook(db, 0);
+
+	snprintf(db->snapshotName, sizeof(db->snapshotName), "%s", snapshotFile);
+	snprintf(db->journalBase, sizeof(db->journalBase), "%s", journalFile);
+
+	// Replay every journal newer than the snapshot, oldest first. There is
+	// normally only one, but there can be two if we crashed while compacting.
+	while (1)
 	{
-		// Write the maximum size of the phonebook and current number of
-		// non empty records.
-		fprintf(fp, "%d %d\n", maxSize, numRecords);
+		journalName(db, name, sizeof(name), generation + 1);
 
-		// Go over all records and store everything. We also store deleted records.
-		for (int i=0; i<numRecords; i++)
-			fprintf(fp, "%d\n%d\n%s\n%s\n%s\n", database[i].index, database[i].deleted, database[i].name, database[i].countryCode, database[i].phoneNumber);
+		if (journalReplay(name, applyEntry, db) < 0)
+			break;
 
-		fclose(fp);
-		return OK;
+		generation++;
 	}
-	else
+
+	// Keep appending to the newest journal, or start the next one
+	if (generation == 0)
+		generation = 1;
+
+	journalName(db, name, sizeof(name), generation);
+
+	if (journalOpen(&db->journal, name, generation, groupSize) != OK)
+		return LOAD_FAIL;
+
+	db->journaling = 1;
+	return OK;
+}
+
+int dbSyncJournal(TPhonebookDB *db)
+{
+	if (!db->journaling)
 		return SAVE_FAIL;
+
+	beginWrite(db);
+	int result = journalSync(&db->journal);
+	endWrite(db);
+
+	return result;
 }
 
-// The fgets function reads everything in a line of text including the newline
-// character. This is usually undesirable, so we define this function that
-// checks if there's a newline character at the end of str and replaces
-// it with a NULL terminator.
+void dbCloseJournal(TPhonebookDB *db)
+{
+	dbWaitCompaction(db);
+
+	if (db->journaling)
+	{
+		journalClose(&db->journal);
+		db->journaling = 0;
+	}
+}
 
-// Note that this function's prototype is NOT listed in db.h, making this 
-// function accessible only locally within db.c.
+// Frees a copy made by copyImage
+static void freeImage(TDBImage *image)
+{
+	free(image->records);
+	free(image->countries);
+	free(image->arena);
+}
 
-void stripNL(char *str)
+// Makes a copy of the database as it is now
+static void copyImage(TPhonebookDB *db, TDBImage *image)
 {
-	// strlen returns the length of the string excluding the terminating '\0'
-	// The newline character is at the end. Since we index from 0
-	// this would be strlen(str) - 1
-	int NLIdx = strlen(str) - 1;
+	currentImage(db, image);
 
-	if (str[NLIdx] == '\r' || str[NLIdx] == '\n')
-		str[NLIdx] = '\0';
+	// malloc(0) may return NULL, so we always ask for at least 1 byte
+	image->records = (TRecord *) malloc(db->numRecords * sizeof(TRecord) + 1);
+	image->countries = (char (*)[C_LENGTH]) malloc(db->numCountries * C_LENGTH + 1);
+	image->arena = (char *) malloc(db->arenaSize + 1);
 
+	memcpy(image->records, db->records, db->numRecords * sizeof(TRecord));
+	memcpy(image->countries, db->countries, db->numCountries * C_LENGTH);
+	memcpy(image->arena, db->arena, db->arenaSize);
 }
 
-int loadDB(char *filename)
+static void *compactMain(void *arg)
 {
-	// Open the file for reading.
-	FILE *fp = fopen(filename, "r");
+	TCompactJob *job = (TCompactJob *) arg;
+	TPhonebookDB *db = job->db;
+	char name[300];
 
-	int dbSize, dbRecords;
+	db->compactResult = writeBinary(db->snapshotName, &job->image, job->generation);
 
-	if (fp != NULL)
+	// The snapshot now has every change up to job->generation, so we can
+	// delete those journals. We go backwards in case an earlier compaction
+	// was interrupted before it deleted its journal.
+	if (db->compactResult == OK)
 	{
-		// Read in the maximum size of the phonebook and # of records including
-		// deleted records
-		fscanf(fp, "%d %d\n", &dbSize, &dbRecords);
-
-		printf("Read %d records max DB size is %d\n", dbRecords, dbSize);
-
-		// Initialize the phonebook. Remember that this will deallocate
-		// any previously initialized phonebooks.
-		initPhonebook(dbSize);
-
-		// Go over each record
-		for (int i=0; i<dbRecords; i++){
-			char buffer[128];
-
-			// Read in the index and delete flags
-			fscanf(fp, "%d\n", &database[i].index);
-			fscanf(fp, "%d\n", &database[i].deleted);
-
-			// We make use of fgets instead of fscanf because fscanf reads only up to
-			// the first white space or newline. So with a name like "Jabba the Hutt",
-			// fscanf will only read in "Jabba". Subsequent fscanf statements will read in
-			// "the", and "Hutt".
-			// fgets will read all the way to the newline character. The problem is that it
-			// also reads in the newline character.
-			fgets(buffer, NAME_LENGTH, fp);
-
-			// So we must call our stripNL function from earlier on to remove it.
-			stripNL(buffer);
-			printf("%d: Name: %s\n", i, buffer);
-			strcpy(database[i].name, buffer);
-
-			fgets(buffer, NAME_LENGTH, fp);
-			stripNL(buffer);
-			printf("%d: Country Code: %s\n", i, buffer);
-			strcpy(database[i].countryCode, buffer);
-
-			fgets(buffer, NAME_LENGTH, fp);
-			stripNL(buffer);
-			printf("%d: Phone Number: %s\n", i, buffer);
-			strcpy(database[i].phoneNumber, buffer);
+		unsigned g;
+
+		for (g=job->generation; g>0; g--)
+		{
+			journalName(db, name, sizeof(name), g);
+
+			if (unlink(name) != 0)
+				break;
 		}
+	}
 
-		// Record maximum phonebook size and number of non empty records.
-		maxSize = dbSize;
-		numRecords = dbRecords;
-		return OK;
+	freeImage(&job->image);
+	free(job);
+	return NULL;
+}
+
+int dbCompactJournal(TPhonebookDB *db)
+{
+	char name[300];
+
+	if (!db->journaling)
+		return SAVE_FAIL;
+
+	// Only one compaction at a time
+	beginWrite(db);
+	dbWaitCompaction(db);
+
+	// Finish the current journal and start the next generation. Changes
+	// from now on go into the new journal, so the snapshot only needs the
+	// records as they are at this moment.
+	unsigned generation = db->journal.generation;
+	int groupSize = db->journal.groupSize;
+
+	journalClose(&db->journal);
+	journalName(db, name, sizeof(name), generation + 1);
+
+	if (journalOpen(&db->journal, name, generation + 1, groupSize) != OK)
+	{
+		db->journaling = 0;
+		endWrite(db);
+		return SAVE_FAIL;
 	}
-	else 
-		return LOAD_FAIL;
+
+	// Copying the records in memory is much faster than writing them out,
+	// so we do that here and leave the writing to the thread.
+	TCompactJob *job = (TCompactJob *) malloc(sizeof(TCompactJob));
+
+	job->db = db;
+	copyImage(db, &job->image);
+	job->generation = generation;
+
+	if (pthread_create(&db->compactThread, NULL, compactMain, job) != 0)
+	{
+		freeImage(&job->image);
+		free(job);
+		endWrite(db);
+		return SAVE_FAIL;
+	}
+
+	db->compacting = 1;
+	endWrite(db);
+	return OK;
+}
+
+int dbWaitCompaction(TPhonebookDB *db)
+{
+	if (db->compacting)
+	{
+		pthread_join(db->compactThread, NULL);
+		db->compacting = 0;
+	}
+
+	return db->compactResult;
+}
+
+// Changes the maximum size to newSize records. Returns OK, or MAX_REACHED
+// if there is not enough memory, in which case maxSize does not change.
+static int growTo(TPhonebookDB *db, int newSize)
+{
+	// A mapped database cannot grow, so we copy it into ordinary memory
+	// first. Indexes hold record numbers, so they stay valid.
+	if (unmapDatabase(db) != OK)
+		return MAX_REACHED;
+
+	// realloc (which resizeArray uses) allocates new memory, copies the contents
+	// from the previous memory, then frees the old memory. We need to save the
+	// address returned because this points to the new expanded memory. If it
+	// fails it returns NULL and leaves the old memory alone, so we must not
+	// overwrite records until we know it worked.
+	TRecord *newRecords = (TRecord *) resizeArray(db, db->records,
+		db->numRecords * sizeof(TRecord), (size_t) newSize * sizeof(TRecord));
+
+	if (newRecords == NULL)
+		return MAX_REACHED;
+
+	db->records = newRecords;
+	db->maxSize = newSize;
+	return OK;
 }
 
-void resizeDB(int numNewRecords)
+void dbResizeDB(TPhonebookDB *db, int numNewRecords)
 {
 	// Increment maximum size by numNewRecords.
-	maxSize += numNewRecords;
+	beginWrite(db);
+	growTo(db, db->maxSize + numNewRecords);
+	endWrite(db);
+}
+
+int dbGrowDB(TPhonebookDB *db)
+{
+	int increment;
+	int result = MAX_REACHED;
+
+	if (db->records == NULL || db->growthPolicy == GROW_NONE)
+		return MAX_REACHED;
+
+	beginWrite(db);
+
+	// Doubling means the total cost of copying records while growing from
+	// 0 to n records is O(n), i.e. O(1) per record added.
+	if (db->growthPolicy == GROW_DOUBLE)
+		increment = db->maxSize > MIN_GROWTH ? db->maxSize : MIN_GROWTH;
+	else
+		increment = db->growthStep;
+
+	if (growTo(db, db->maxSize + increment) == OK)
+	{
+		db->numGrowths++;
+		result = OK;
+	}
+
+	endWrite(db);
+	return result;
+}
+
+void dbSetGrowthPolicy(TPhonebookDB *db, int policy, int step)
+{
+	db->growthPolicy = policy;
+	db->growthStep = step > 0 ? step : MIN_GROWTH;
+}
+
+void dbGetDBMemory(TPhonebookDB *db, TDBMemory *mem)
+{
+	// A mapped database is all in one piece, so we count it all as records
+	if (db->mapBase != NULL)
+	{
+		mem->records = db->mapLength;
+		mem->arena = 0;
+		mem->countries = 0;
+	}
+	else
+	{
+		mem->records = (size_t) db->maxSize * sizeof(TRecord);
+		mem->arena = db->arenaCapacity;
+		mem->countries = (size_t) db->countryCapacity * C_LENGTH;
+	}
+
+	mem->countries += (size_t) db->countryIndex.capacity * (sizeof(int) + sizeof(unsigned));
+	mem->nameIndex = (size_t) db->nameIndex.capacity * (sizeof(int) + sizeof(unsigned));
+	mem->phoneIndex = (size_t) db->phoneIndex.capacity * (sizeof(int) + sizeof(unsigned)) +
+		(size_t) db->ownerCapacity * sizeof(TOwnerLink);
+	mem->sortedIndex = (size_t) db->nameOrder.leaves * sizeof(TBTreeNode) +
+		(size_t) db->nameOrder.inners * (sizeof(TBTreeNode) + BTREE_ORDER * sizeof(TBTreeNode *));
+	mem->freeList = (size_t) db->freeCapacity * sizeof(int);
+	mem->total = mem->records + mem->arena + mem->countries + mem->nameIndex + mem->phoneIndex + mem->sortedIndex + mem->freeList;
+	mem->growths = db->numGrowths;
+}
+
+int dbCompactDB(TPhonebookDB *db)
+{
+	int i, live = 0;
+	size_t size = 0;
+
+	if (db->records == NULL)
+		return 0;
+
+	beginWrite(db);
+
+	// The live entries go into a new arena, packed together. The +1 is because
+	// malloc(0) may return NULL.
+	char *newArena = (char *) malloc(db->arenaSize - db->arenaWaste + 1);
 
-	// realloc allocates new memory, copies the contents from the previous memory pointed
-	// to by database, then frees the old memory. We need to save the address returned by
-	// realloc because this points to the new expanded memory.
-	database = (TPhonebook *) realloc(database, sizeof(TPhonebook) * maxSize);
+	if (unmapDatabase(db) != OK || newArena == NULL)
+	{
+		free(newArena);
+		endWrite(db);
+		return 0;
+	}
+
+	// Slide every record that is not deleted down over the deleted ones,
+	// keeping them in the same order.
+	for (i=0; i<db->numRecords; i++)
+		if (!db->records[i].deleted)
+		{
+			size_t bytes = entrySize(db, i);
+
+			memcpy(newArena + size, db->arena + db->records[i].name, bytes);
+			db->records[live] = db->records[i];
+			db->records[live].name = size;
+			size += bytes;
+			live++;
+		}
+
+	int removed = db->numRecords - live;
+
+	retireMemory(db, db->arena, 0);
+	db->arena = newArena;
+	db->arenaSize = size;
+	db->arenaCapacity = size + 1;
+
+	// Records have moved, so the indexes must be rebuilt. This also empties
+	// the free list, since there are no deleted records left.
+	db->numRecords = live;
+	buildIndexes(db);
+
+	endWrite(db);
+	return removed;
+}
+
+void dbSetCompactThreshold(TPhonebookDB *db, double ratio)
+{
+	db->compactRatio = ratio;
 }
 
-void getDBSize(int *nr, int *ms)
+void dbGetDBSize(TPhonebookDB *db, int *nr, int *ms)
 {
-	*nr = numRecords;
-	*ms = maxSize;
+	*nr = db->numRecords;
+	*ms = db->maxSize;
 }
 
-void freePhonebook()
+void dbFreePhonebook(TPhonebookDB *db)
 {
-	if (database != NULL)
-		free(database);
+	dbSetConcurrent(db, 0);
+	dbCloseJournal(db);
+	dbWaitSave(db);
+	releaseDatabase(db);
 }
 
+void dbDestroy(TPhonebookDB *db)
+{
+	if (db == NULL)
+		return;
+
+	dbFreePhonebook(db);
+	free(db);
+}
@@ -11,6 +11,8 @@
 
 #define PHONEBOOK
 
+#include <stddef.h>
+
 // We use #define to define constants, rather than to use numeric values in the code
 // so that if we, for example, wanted to change the maximum length of the name,
 // we can just change it here, rather than have to locate and change a value
@@ -25,7 +27,8 @@
 // an index number, a deleted flag, the person's name, country code and 
 // phone number.
 // Notice we use the constants like NAME_LENGTH defined above.
-//
+// This is how the functions below hand out people. Inside db.c people are stored
+// more compactly, with names and phone numbers packed together whatever their length.
 
 typedef struct
 {
@@ -51,9 +54,59 @@ enum
 	DUPLICATE=2,
 	CANNOT_FIND=3,
 	SAVE_FAIL=4,
-	LOAD_FAIL=5
+	LOAD_FAIL=5,
+	SAVE_RUNNING=6
 };
 
+// Growth policies for setGrowthPolicy
+enum
+{
+	GROW_NONE=0,		// Never grow. addPerson returns MAX_REACHED when the phonebook is full
+	GROW_DOUBLE=1,		// Double the maximum size
+	GROW_FIXED=2		// Add a fixed number of records to the maximum size
+};
+
+// Memory used by the phonebook, in bytes, as reported by getDBMemory
+typedef struct
+{
+	size_t records;
+	size_t arena;		// Names and phone numbers
+	size_t countries;
+	size_t nameIndex;
+	size_t phoneIndex;
+	size_t sortedIndex;
+	size_t freeList;
+	size_t total;
+	int growths;		// Number of times addPerson has grown the phonebook
+} TDBMemory;
+
+// What importCSV did with the lines of a file
+typedef struct
+{
+	int added;			// People added
+	int duplicates;		// Lines with a name that was already in the phonebook, or earlier in the file
+	int invalid;		// Lines that are not of the form name,countryCode,phoneNumber
+} TImportStats;
+
+// Where a listing has got to, see startListing and nextListing. Only db.c
+// should look inside.
+typedef struct
+{
+	char from[NAME_LENGTH];		// The next page starts here
+	char to[NAME_LENGTH];		// The listing stops before this name, or "" for no end
+	int skipFrom;				// 1 if from was on the last page
+} TListCursor;
+
+// A phonebook. Only db.c knows what is inside, so other files just hold
+// pointers to phonebooks made by dbCreate.
+typedef struct TPhonebookDB TPhonebookDB;
+
+// db.c is C, so C++ programs that use it (like the web server in cs2106lab5)
+// must be told not to mangle the function names.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Function prototypes. This is probably the most important part of the .h
 // file because it allows your main program to access the functions that are
 // inside our library. In the following comments you will see "Pre" and "Post"
@@ -61,44 +114,120 @@ enum
 // the contents of the parameters. "Post" conditions state the final state of 
 // the system, and any return values. It is always a good idea to state Pre
 // and Post conditions.
+//
+// A program can have as many phonebooks as it likes, e.g. one per customer.
+// Every function below apart from dbCreate, startListing and setLoadProgress
+// takes the phonebook to work on as db. In the Pre and Post conditions,
+// "phonebook" means db. Phonebooks share nothing, so different threads can
+// work on different phonebooks at the same time without waiting for each other.
+
+// Makes a new phonebook.
+// Pre: None.
+// Post: Returns a phonebook that is not initialized yet, or NULL if there is not enough memory.
+TPhonebookDB *dbCreate();
+
+// Gets rid of a phonebook.
+// Pre: db was made by dbCreate, or is NULL.
+// Post: db is freed, along with everything in it, and must not be used again.
+void dbDestroy(TPhonebookDB *db);
 
 // Initializes the phonebook for a maximum of maxRecords file.
 // Pre: Phonebook is uninitialized, maxRecords contains maximum
 // number of records in our phonebook
 // Post: Phonebook is initialized to maxRecords records, each of which is empty.
-void initPhonebook(int maxRecords);
+void dbInitPhonebook(TPhonebookDB *db, int maxRecords);
 
 // Frees the phonebook.
-// Pre: Phonebook was previously initialized by initPhonebook
+// Pre: Phonebook was previously initialized by dbInitPhonebook
 // Post: Phonebook is freed and no longer accessible.
-void freePhonebook();
+void dbFreePhonebook(TPhonebookDB *db);
 
 // Adds in a new person into the phonebook
 // Pre: Phonebook has been initialized. name = Name of person, countryCode = 3 digit country code, phoneNumber = 7 digit phone number
 // Post: Person is inserted into phonebook if he isn't already there. The "result" parameter returns OK, MAX_REACHED or DUPLICATE
-void addPerson(char *name, char *countryCode, char *phoneNumber, int *result);
+// If the phonebook is full it grows according to the growth policy (see setGrowthPolicy), so MAX_REACHED
+// is only returned under GROW_NONE, when we run out of memory, or when there are already 65535 different
+// country codes.
+void dbAddPerson(TPhonebookDB *db, char *name, char *countryCode, char *phoneNumber, int *result);
 
 // Looks for a person in the phonebook. We do a full string match, and cannot do partial matches.
 // Pre: Phonebook has been initialized. name = Name of person to search for.
-// Post: Returns a pointer to the structure containing details of the person if found, or NULL if not found.
-TPhonebook *findPerson(char *name);
+// Post: Returns a pointer to a copy of the details of the person if found, or NULL if not found.
+// The copy belongs to the calling thread and is overwritten by its next call to dbFindPerson,
+// on any phonebook. Changing it does not change the phonebook.
+TPhonebook *dbFindPerson(TPhonebookDB *db, char *name);
+
+// Looks for the owner of a phone number, e.g. to show who is calling. Full matches only.
+// Pre: Phonebook has been initialized. countryCode and phoneNumber = Number to search for.
+// Post: Returns a pointer to a copy of the details of the person if found, or NULL if not found.
+// If several people share the number, one of them is returned. The copy is the same one
+// dbFindPerson uses, so it is overwritten by the next call to either function.
+TPhonebook *dbFindNumber(TPhonebookDB *db, char *countryCode, char *phoneNumber);
+
+// Looks for people whose names start with a prefix, e.g. "Ta" finds "Tan Ah Kow" and "Tay Boon Hock".
+// This is meant for type-ahead searches, so we return only the first few matches.
+// Pre: Phonebook has been initialized. prefix = Start of the names to search for. results = array of at least k people.
+// Post: results contains copies of up to k matching people in alphabetical order. Returns the number of people found.
+int dbFindPrefix(TPhonebookDB *db, char *prefix, TPhonebook *results, int k);
+
+// Looks for people whose names contain some text anywhere, e.g. "Ah" finds "Tan Ah Kow" and "Ahmad".
+// Every name is checked, using the vector instructions of the CPU and, for large phonebooks,
+// several threads, see strscan.h.
+// Pre: Phonebook has been initialized. text = Text to search for. ignoreCase = 1 if upper and lower
+// case letters should match each other. results = array of at least k people.
+// Post: results contains copies of the first k matching people in order of their index. Returns the
+// number of people found, which can be more than k. To get every match, call again with k at least
+// as large as the number returned.
+int dbFindContaining(TPhonebookDB *db, char *text, int ignoreCase, TPhonebook *results, int k);
+
+// Starts a listing of people in alphabetical order, e.g. from "M" to "N" lists everyone whose
+// name starts with M. The listing is read a page at a time with nextListing.
+// Pre: cursor = listing to start. from = first name to list, to = name to stop before. Either
+// can be NULL or "" to start at the beginning or stop at the end of the phonebook.
+// Post: cursor is at the start of the listing.
+void startListing(TListCursor *cursor, char *from, char *to);
+
+// Reads the next page of a listing. Each page carries on from the name the last one ended
+// with, so the phonebook can change between pages. Each call takes O(log n + k) time.
+// Pre: Phonebook has been initialized. cursor was started by startListing. results = array of at least k people.
+// Post: results contains copies of up to k people in alphabetical order. Returns the number of people
+// found, which is 0 at the end of the listing.
+int dbNextListing(TPhonebookDB *db, TListCursor *cursor, TPhonebook *results, int k);
+
+// Looks for a person and copies their details. Unlike findPerson, this can be called from
+// several threads at once, and at the same time as addPerson and deletePerson, in concurrent mode.
+// Pre: Phonebook has been initialized. name = Name of person to search for.
+// Post: If found, person contains a copy of their details and function returns OK. If not,
+// function returns CANNOT_FIND.
+int dbFindPersonCopy(TPhonebookDB *db, char *name, TPhonebook *person);
+
+// Turn concurrent mode on or off
+// In concurrent mode any number of threads can call dbFindPersonCopy while other threads call
+// dbAddPerson, dbDeletePerson, dbCompactDB, dbResizeDB, dbGrowDB, dbSyncJournal and dbCompactJournal
+// on the same phonebook. dbFindPersonCopy never waits for a lock, so lookups do not slow each other
+// down. Changes are made one at a time. All other functions, including dbFindPerson and dbFindPrefix,
+// must only be called when no other thread is changing the phonebook.
+// Pre: Phonebook is initialized. No other thread is using the phonebook.
+// Post: Concurrent mode is on if on = 1 or off if on = 0. Returns OK, or CANNOT_FIND if the
+// phonebook is not initialized.
+int dbSetConcurrent(TPhonebookDB *db, int on);
 
 // Lists contents of phone book
 // Pre: Phonebook has been initialized.
-// Post: Phonebook is listed on stdout.
-void listPhonebook();
+// Post: Phonebook is listed on stdout in alphabetical order.
+void dbListPhonebook(TPhonebookDB *db);
 
 // Deletes a person.
 // Pre: Phonebook is initialized. name = Name of person to delete. Full string matches only.
 // Post: Person in "name" is removed if he exists and deletePerson returns OK. If he doesn't
 // exists, function returns CANNOT_FIND
-int deletePerson(char *name);
+int dbDeletePerson(TPhonebookDB *db, char *name);
 
 // Save phonebook
 // Pre: Phonebook is initialized. filename = name of file to write phonebook to.
 // Post: Returns OK if successful and data is written to filename, or SAVE_FAIL
 // if an error occurs. Data is not guaranteed to be saved in this case.
-int saveDB(char *filename);
+int dbSaveDB(TPhonebookDB *db, char *filename);
 
 // Load phonebook
 // Pre: filename = name of file to load phonebook from. Phonebook does not need
@@ -106,19 +235,190 @@ int saveDB(char *filename);
 // Post: If successful, phonebook is initialized and contents of filename are loaded,
 // and function returns OK. If failure, function returns LOAD_FAIL and phonebook
 // may be invalid.
-int loadDB(char *filename);
+int dbLoadDB(TPhonebookDB *db, char *filename);
+
+// Import a CSV file
+// Each line of the file is name,countryCode,phoneNumber, e.g. "Tan Ah Kow",65,91234567. Names can be
+// in double quotes so that they can have commas in them. Country codes can start with a +, and spaces
+// and dashes in phone numbers are dropped. Further columns are ignored, and if the first line is not
+// valid it is taken to be a header. The file is split into chunks that are parsed and checked by
+// numThreads threads at once, while the results are added to the phonebook in file order.
+// Pre: Phonebook has been initialized. filename = name of CSV file. numThreads = number of threads
+// to parse with, or 0 for one per CPU.
+// Post: Valid lines are added to the phonebook as if by addPerson, and stats says what happened to
+// each line. Returns OK, LOAD_FAIL if the file cannot be read, or MAX_REACHED if the phonebook
+// filled up, in which case only the lines before that were added.
+int dbImportCSV(TPhonebookDB *db, char *filename, int numThreads, TImportStats *stats);
+
+// Turn progress messages for dbLoadDB on or off, for every phonebook. They are off by default,
+// and when they are on dbLoadDB prints a message at most every half a second.
+// Pre: None.
+// Post: If on = 1 dbLoadDB prints progress messages, if on = 0 it does not.
+void setLoadProgress(int on);
+
+// Save phonebook in binary format
+// The binary format is a header followed by the pieces of the phonebook as they are in
+// memory: an 8 byte record for each person, the table of country codes, and the arena that
+// holds the names and phone numbers. This makes it much faster to save and load than the
+// text format used by saveDB.
+// Pre: Phonebook is initialized. filename = name of file to write phonebook to.
+// Post: Returns OK if successful and data is written to filename, or SAVE_FAIL
+// if an error occurs. If filename already existed, it is left as it was.
+int dbSaveDBBinary(TPhonebookDB *db, char *filename);
+
+// Save phonebook in the background
+// Starts writing the phonebook as it is now to filename, and returns straight away instead of
+// waiting for the write. The phonebook can be used and changed while the save runs, and the
+// changes do not end up in the file. The save is done by a separate process made with fork,
+// which shares the phonebook's memory with us, so starting it does not copy the phonebook.
+// Only one background save of a phonebook can run at a time, and only one thread should start,
+// check on or wait for them.
+// Pre: Phonebook is initialized. filename = name of file to write phonebook to. binary = 1 to
+// use the format of saveDBBinary, 0 for that of saveDB.
+// Post: Returns OK if the save was started, or SAVE_FAIL if it could not be started or another
+// save is still running. Use dbGetSaveStatus or dbWaitSave to find out how it went.
+int dbSaveDBBackground(TPhonebookDB *db, char *filename, int binary);
+
+// Check on a background save
+// Pre: None.
+// Post: Returns SAVE_RUNNING if the save started by dbSaveDBBackground has not finished yet.
+// Otherwise returns OK if the last background save succeeded, or there has not been one, or
+// SAVE_FAIL if it failed.
+int dbGetSaveStatus(TPhonebookDB *db);
+
+// Wait for a background save
+// Pre: None.
+// Post: Any background save has finished. Returns OK if the last one succeeded, or SAVE_FAIL if not.
+int dbWaitSave(TPhonebookDB *db);
+
+// Load phonebook in binary format
+// The file is mapped into memory with mmap rather than read, so records are only read
+// from disk when they are first used. Changes to the phonebook never change the file.
+// Pre: filename = name of a file written by saveDBBinary. Phonebook does not need to be
+// initialized. verify = 1 to check the checksum, which means reading the whole file.
+// Every record is checked to lie inside the file whether or not verify is set.
+// Post: If successful, the phonebook contains the contents of filename and function returns OK.
+// If failure, function returns LOAD_FAIL and the phonebook is unchanged.
+int dbLoadDBBinary(TPhonebookDB *db, char *filename, int verify);
+
+// Recover phonebook and start journaling
+// While journaling is on, every addPerson and deletePerson is appended to a journal file,
+// which is much cheaper than saving the whole phonebook. compactJournal folds the journal
+// into a binary snapshot now and then, so the journal does not grow forever.
+// Pre: snapshotFile = name of the snapshot, journalFile = start of the journal file names
+// (journals are named journalFile.1, journalFile.2, ...). groupSize = number of changes to
+// collect before each fsync. If there is no snapshot yet, the phonebook is used as it is.
+// Post: If successful, the phonebook contains the snapshot plus every change in the journals,
+// journaling is on, and function returns OK. If failure, function returns LOAD_FAIL.
+int dbRecoverDB(TPhonebookDB *db, char *snapshotFile, char *journalFile, int groupSize);
+
+// Sync journal
+// Pre: Journaling is on.
+// Post: Every change so far is on disk. Returns OK, or SAVE_FAIL if an error occurs.
+int dbSyncJournal(TPhonebookDB *db);
+
+// Stop journaling
+// Pre: None.
+// Post: Any compaction has finished, the journal is synced and closed, and journaling is off.
+void dbCloseJournal(TPhonebookDB *db);
+
+// Compact journal
+// Starts a new journal, and writes the phonebook as it is now to the snapshot in a
+// background thread. The old journal is deleted once the snapshot is safely on disk.
+// Pre: Journaling is on.
+// Post: Returns OK if the compaction was started, or SAVE_FAIL if not.
+int dbCompactJournal(TPhonebookDB *db);
+
+// Wait for compaction
+// Pre: None.
+// Post: Any compaction in progress has finished. Returns OK if the last compaction
+// succeeded, or SAVE_FAIL if not.
+int dbWaitCompaction(TPhonebookDB *db);
 
 // Resize phonebook
 // Pre: Phonebook is initially initialized to a maximum size
 // in number of records.
 // numNewRecords = Maximum number of records is incremented by this number
 // Post: Maximum size of phonebook is incremented by numNewRecords.
-void resizeDB(int numNewRecords);
+void dbResizeDB(TPhonebookDB *db, int numNewRecords);
+
+// Grow phonebook
+// Pre: Phonebook is initialized.
+// Post: Maximum size of phonebook is increased according to the growth policy. Returns OK,
+// or MAX_REACHED if the policy is GROW_NONE or there is not enough memory.
+int dbGrowDB(TPhonebookDB *db);
+
+// Set growth policy
+// Pre: policy = GROW_NONE, GROW_DOUBLE or GROW_FIXED. step = number of records GROW_FIXED adds each time.
+// Post: addPerson grows the phonebook according to policy when it is full. The default is GROW_DOUBLE.
+void dbSetGrowthPolicy(TPhonebookDB *db, int policy, int step);
+
+// Get memory used by phonebook
+// Pre: Phonebook is initialized.
+// Post: mem contains the number of bytes used by the records and each index.
+void dbGetDBMemory(TPhonebookDB *db, TDBMemory *mem);
+
+// Compact phonebook
+// deletePerson only marks records as deleted. addPerson reuses their slots, but if there
+// are more deletes than adds, the deleted records pile up. This removes them.
+// Pre: Phonebook is initialized.
+// Post: Deleted records are removed and the rest are moved to the start of the phonebook,
+// in the same order. The index field of people returned earlier may no longer be right.
+// Returns the number of deleted records removed.
+int dbCompactDB(TPhonebookDB *db);
+
+// Set automatic compaction threshold
+// Pre: ratio = fraction of deleted records at which deletePerson calls compactDB by itself,
+// e.g. 0.5 for half. 0 turns automatic compaction off. The default is 0.5.
+// Post: Threshold is set. Note that this means deletePerson can move records.
+void dbSetCompactThreshold(TPhonebookDB *db, double ratio);
 
 // Get size of phonebook
 // Pre: Phonebook is initialized.
 // Post: nr = Number of non-empty records in phonebook, ms = Maximum size of phonebook in records.
+void dbGetDBSize(TPhonebookDB *db, int *nr, int *ms);
+
+// The functions below are what db.c offered before it could hold more than one
+// phonebook, and are kept so that programs written for them still work. Each
+// one works on a single phonebook of its own, made the first time it is needed,
+// and does the same as the db function of the same name, e.g. addPerson(...)
+// is dbAddPerson(db, ...) with that phonebook as db.
+void initPhonebook(int maxRecords);
+void freePhonebook();
+void addPerson(char *name, char *countryCode, char *phoneNumber, int *result);
+TPhonebook *findPerson(char *name);
+TPhonebook *findNumber(char *countryCode, char *phoneNumber);
+int findPrefix(char *prefix, TPhonebook *results, int k);
+int findContaining(char *text, int ignoreCase, TPhonebook *results, int k);
+int nextListing(TListCursor *cursor, TPhonebook *results, int k);
+int findPersonCopy(char *name, TPhonebook *person);
+int setConcurrent(int on);
+void listPhonebook();
+int deletePerson(char *name);
+int saveDB(char *filename);
+int loadDB(char *filename);
+int importCSV(char *filename, int numThreads, TImportStats *stats);
+int saveDBBinary(char *filename);
+int saveDBBackground(char *filename, int binary);
+int getSaveStatus();
+int waitSave();
+int loadDBBinary(char *filename, int verify);
+int recoverDB(char *snapshotFile, char *journalFile, int groupSize);
+int syncJournal();
+void closeJournal();
+int compactJournal();
+int waitCompaction();
+void resizeDB(int numNewRecords);
+int growDB();
+void setGrowthPolicy(int policy, int step);
+void getDBMemory(TDBMemory *mem);
+int compactDB();
+void setCompactThreshold(double ratio);
 void getDBSize(int *nr, int *ms);
 
+#ifdef __cplusplus
+}
+#endif
+
 // Endif for the #ifndef at the start
 #endif
@@ -0,0 +1,190 @@
+// The functions db.c offered before it could hold more than one phonebook.
+// Each one just calls the db function of the same name on a phonebook that
+// we make the first time any of them is called, see db.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "db.h"
+
+static TPhonebookDB *defaultDB = NULL;
+static pthread_once_t defaultOnce = PTHREAD_ONCE_INIT;
+
+static void makeDefault()
+{
+	defaultDB = dbCreate();
+
+	if (defaultDB == NULL)
+	{
+		fprintf(stderr, "Not enough memory for the phonebook\n");
+		exit(-1);
+	}
+}
+
+// Returns the phonebook the functions below work on. pthread_once makes sure
+// only one is made even if several threads call this at the same time.
+static TPhonebookDB *book()
+{
+	pthread_once(&defaultOnce, makeDefault);
+	return defaultDB;
+}
+
+void initPhonebook(int maxRecords)
+{
+	dbInitPhonebook(book(), maxRecords);
+}
+
+void freePhonebook()
+{
+	dbFreePhonebook(book());
+}
+
+void addPerson(char *name, char *countryCode, char *phoneNumber, int *result)
+{
+	dbAddPerson(book(), name, countryCode, phoneNumber, result);
+}
+
+TPhonebook *findPerson(char *name)
+{
+	return dbFindPerson(book(), name);
+}
+
+TPhonebook *findNumber(char *countryCode, char *phoneNumber)
+{
+	return dbFindNumber(book(), countryCode, phoneNumber);
+}
+
+int findPrefix(char *prefix, TPhonebook *results, int k)
+{
+	return dbFindPrefix(book(), prefix, results, k);
+}
+
+int findContaining(char *text, int ignoreCase, TPhonebook *results, int k)
+{
+	return dbFindContaining(book(), text, ignoreCase, results, k);
+}
+
+int nextListing(TListCursor *cursor, TPhonebook *results, int k)
+{
+	return dbNextListing(book(), cursor, results, k);
+}
+
+int findPersonCopy(char *name, TPhonebook *person)
+{
+	return dbFindPersonCopy(book(), name, person);
+}
+
+int setConcurrent(int on)
+{
+	return dbSetConcurrent(book(), on);
+}
+
+void listPhonebook()
+{
+	dbListPhonebook(book());
+}
+
+int deletePerson(char *name)
+{
+	return dbDeletePerson(book(), name);
+}
+
+int saveDB(char *filename)
+{
+	return dbSaveDB(book(), filename);
+}
+
+int loadDB(char *filename)
+{
+	return dbLoadDB(book(), filename);
+}
+
+int importCSV(char *filename, int numThreads, TImportStats *stats)
+{
+	return dbImportCSV(book(), filename, numThreads, stats);
+}
+
+int saveDBBinary(char *filename)
+{
+	return dbSaveDBBinary(book(), filename);
+}
+
+int saveDBBackground(char *filename, int binary)
+{
+	return dbSaveDBBackground(book(), filename, binary);
+}
+
+int getSaveStatus()
+{
+	return dbGetSaveStatus(book());
+}
+
+int waitSave()
+{
+	return dbWaitSave(book());
+}
+
+int loadDBBinary(char *filename, int verify)
+{
+	return dbLoadDBBinary(book(), filename, verify);
+}
+
+int recoverDB(char *snapshotFile, char *journalFile, int groupSize)
+{
+	return dbRecoverDB(book(), snapshotFile, journalFile, groupSize);
+}
+
+int syncJournal()
+{
+	return dbSyncJournal(book());
+}
+
+void closeJournal()
+{
+	dbCloseJournal(book());
+}
+
+int compactJournal()
+{
+	return dbCompactJournal(book());
+}
+
+int waitCompaction()
+{
+	return dbWaitCompaction(book());
+}
+
+void resizeDB(int numNewRecords)
+{
+	dbResizeDB(book(), numNewRecords);
+}
+
+int growDB()
+{
+	return dbGrowDB(book());
+}
+
+void setGrowthPolicy(int policy, int step)
+{
+	dbSetGrowthPolicy(book(), policy, step);
+}
+
+void getDBMemory(TDBMemory *mem)
+{
+	dbGetDBMemory(book(), mem);
+}
+
+int compactDB()
+{
+	return dbCompactDB(book());
+}
+
+void setCompactThreshold(double ratio)
+{
+	dbSetCompactThreshold(book(), ratio);
+}
+
+void getDBSize(int *nr, int *ms)
+{
+	dbGetDBSize(book(), nr, ms);
+}
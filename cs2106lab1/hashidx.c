@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include "hashidx.h"
+
+// Smallest number of slots we ever allocate
+#define MIN_CAPACITY	16
+
+unsigned hashString(const char *str)
+{
+	// These two constants are part of the FNV-1a definition.
+	unsigned hash = 2166136261u;
+
+	while (*str)
+	{
+		hash ^= (unsigned char) *str++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Default release function. It has no use for ctx.
+static void releaseSlots(void *ctx, void *ptr)
+{
+	(void) ctx;
+	free(ptr);
+}
+
+// Allocates the slot arrays and marks every slot as empty.
+static void allocSlots(THashIndex *index, int capacity)
+{
+	int i;
+
+	index->capacity = capacity;
+	index->count = 0;
+	index->recs = (int *) malloc(capacity * sizeof(int));
+	index->hashes = (unsigned *) malloc(capacity * sizeof(unsigned));
+
+	for (i=0; i<capacity; i++)
+		index->recs[i] = -1;
+}
+
+void hashInit(THashIndex *index, int expected)
+{
+	int capacity = MIN_CAPACITY;
+
+	// Keep the index at most half full
+	while (capacity < 2 * expected)
+		capacity *= 2;
+
+	allocSlots(index, capacity);
+	index->release = releaseSlots;
+	index->releaseCtx = NULL;
+}
+
+void hashFree(THashIndex *index)
+{
+	index->release(index->releaseCtx, index->recs);
+	index->release(index->releaseCtx, index->hashes);
+	index->recs = NULL;
+	index->hashes = NULL;
+	index->capacity = 0;
+	index->count = 0;
+}
+
+void hashClear(THashIndex *index)
+{
+	int i;
+
+	for (i=0; i<index->capacity; i++)
+		index->recs[i] = -1;
+
+	index->count = 0;
+}
+
+// Puts a record into the first free slot from its home slot onwards.
+// The caller makes sure there is a free slot.
+static void placeRecord(THashIndex *index, unsigned hash, int rec)
+{
+	unsigned mask = index->capacity - 1;
+	unsigned i = hash & mask;
+
+	while (index->recs[i] >= 0)
+		i = (i + 1) & mask;
+
+	index->recs[i] = rec;
+	index->hashes[i] = hash;
+	index->count++;
+}
+
+// Doubles the number of slots and puts every record back in. Records
+// may move because their home slots change with the capacity.
+static void grow(THashIndex *index)
+{
+	int *oldRecs = index->recs;
+	unsigned *oldHashes = index->hashes;
+	int oldCapacity = index->capacity;
+	int i;
+
+	allocSlots(index, oldCapacity * 2);
+
+	for (i=0; i<oldCapacity; i++)
+		if (oldRecs[i] >= 0)
+			placeRecord(index, oldHashes[i], oldRecs[i]);
+
+	index->release(index->releaseCtx, oldRecs);
+	index->release(index->releaseCtx, oldHashes);
+}
+
+void hashInsert(THashIndex *index, unsigned hash, int rec)
+{
+	if (2 * (index->count + 1) > index->capacity)
+		grow(index);
+
+	placeRecord(index, hash, rec);
+}
+
+int hashFind(THashIndex *index, unsigned hash, THashMatch match, void *ctx, const void *key)
+{
+	unsigned mask = index->capacity - 1;
+	unsigned i = hash & mask;
+	int probes;
+
+	// An empty slot ends the search, because insert would have used it.
+	// We compare hash values first, and only call match when they are
+	// equal, which avoids most string compares. We read each slot only
+	// once, because in concurrent mode a writer may empty it between two
+	// reads, and match would then be called with -1.
+	for (probes=0; probes<index->capacity; probes++)
+	{
+		int rec = index->recs[i];
+
+		if (rec < 0)
+			break;
+
+		if (index->hashes[i] == hash && match(ctx, rec, key))
+			return rec;
+
+		i = (i + 1) & mask;
+	}
+
+	return -1;
+}
+
+void hashPrefetch(THashIndex *index, unsigned hash)
+{
+	unsigned i = hash & (index->capacity - 1);
+
+	__builtin_prefetch(&index->hashes[i]);
+	__builtin_prefetch(&index->recs[i]);
+}
+
+int hashRemove(THashIndex *index, unsigned hash, int rec)
+{
+	unsigned mask = index->capacity - 1;
+	unsigned i = hash & mask;
+
+	while (index->recs[i] >= 0 && index->recs[i] != rec)
+		i = (i + 1) & mask;
+
+	if (index->recs[i] < 0)
+		return 0;
+
+	// We cannot just empty the slot, because that would end the search for
+	// any record after it that was pushed past its home slot. Instead we
+	// move such records back into the gap. This is called "backward shift
+	// deletion", and means we never need "deleted" markers in the index.
+	unsigned gap = i;
+
+	i = (i + 1) & mask;
+
+	while (index->recs[i] >= 0)
+	{
+		unsigned home = index->hashes[i] & mask;
+
+		// The record at i can move into the gap only if its home slot is
+		// not between the gap and i (going round the end of the array if
+		// we have to).
+		if (((i - home) & mask) >= ((i - gap) & mask))
+		{
+			index->recs[gap] = index->recs[i];
+			index->hashes[gap] = index->hashes[i];
+			gap = i;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	index->recs[gap] = -1;
+	index->count--;
+	return 1;
+}
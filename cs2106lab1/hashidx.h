@@ -0,0 +1,83 @@
+// This is the header file for a hash index. A hash index lets us find a
+// record from its key (e.g. a person's name) without looking at every
+// record in the phonebook.
+
+#ifndef HASHIDX
+
+#define HASHIDX
+
+// The index does not store any keys itself. It only stores record numbers,
+// together with the hash value of each record's key. To check whether a
+// record really has the key we are looking for, the index calls a "match"
+// function that we pass in. ctx is passed through to the match function
+// untouched, and key is whatever we are looking for.
+typedef int (*THashMatch)(void *ctx, int rec, const void *key);
+
+// Called to free slot arrays the index no longer uses. hashInit sets it to
+// something that calls free, but a program that reads the index from other
+// threads can change it to something that frees the arrays later, once no
+// thread is reading them. ctx is the index's releaseCtx, passed through untouched.
+typedef void (*THashRelease)(void *ctx, void *ptr);
+
+// We use open addressing: all the entries live in one array of slots, and
+// if the slot a hash value maps to is taken we simply try the next slot,
+// and the one after that, and so on. This is called "linear probing".
+// The array size is always a power of 2, so we can use "& (capacity - 1)"
+// instead of the slower "% capacity" to wrap around.
+
+typedef struct
+{
+	int *recs;			// Record number in each slot, or -1 if the slot is empty
+	unsigned *hashes;	// Hash value of the key of the record in each slot
+	int capacity;		// Number of slots
+	int count;			// Number of slots in use
+	THashRelease release;	// Frees old slot arrays
+	void *releaseCtx;		// Passed to release
+} THashIndex;
+
+// Computes a hash value for a string. We use FNV-1a, which is simple and
+// spreads similar strings (like "Tan Ah Kow" and "Tan Ah Kaw") well.
+unsigned hashString(const char *str);
+
+// Initializes an index that can hold at least expected records without growing.
+// Pre: index is uninitialized.
+// Post: index is empty.
+void hashInit(THashIndex *index, int expected);
+
+// Frees an index.
+// Pre: index was initialized by hashInit.
+// Post: Memory used by index is freed.
+void hashFree(THashIndex *index);
+
+// Removes all records from an index.
+// Pre: index was initialized by hashInit.
+// Post: index is empty, but keeps its capacity.
+void hashClear(THashIndex *index);
+
+// Adds a record to the index. The index doubles in size when it is more than
+// half full, so that searches stay short.
+// Pre: index was initialized by hashInit. hash = hash value of the record's key.
+// Post: rec is in the index.
+void hashInsert(THashIndex *index, unsigned hash, int rec);
+
+// Looks for a record with a given key.
+// Pre: index was initialized by hashInit. hash = hash value of key.
+// Post: Returns the first record rec in the index for which match(ctx, rec, key)
+// returns non-zero, or -1 if there is none. At most capacity slots are looked at,
+// so a search cannot loop forever even if another thread is changing the index.
+int hashFind(THashIndex *index, unsigned hash, THashMatch match, void *ctx, const void *key);
+
+// Starts loading the slot a search for hash would look at first, without waiting
+// for it. Calling this a few records ahead of hashFind lets the CPU fetch several
+// slots from memory at once instead of one after the other.
+// Pre: index was initialized by hashInit.
+// Post: None, apart from the slot maybe being in the cache.
+void hashPrefetch(THashIndex *index, unsigned hash);
+
+// Removes a record from the index.
+// Pre: index was initialized by hashInit. hash = hash value of the record's key.
+// Post: rec is no longer in the index. Returns 1 if rec was found, 0 otherwise.
+int hashRemove(THashIndex *index, unsigned hash, int rec);
+
+// Endif for the #ifndef at the start
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC	0x4C4E524A		// "JRNL" when read as bytes
+
+// Checksum of everything in an entry except the checksum itself. This is
+// FNV-1a again, see hashidx.c.
+static unsigned checksumEntry(TJournalEntry *entry)
+{
+	const unsigned char *bytes = (const unsigned char *) entry;
+	unsigned hash = 2166136261u;
+
+	for (size_t i=0; i<offsetof(TJournalEntry, checksum); i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Counts the complete entries at the start of an open journal file, and
+// leaves the file position just after the last of them. Stops at the first
+// entry that is cut short or has a bad checksum.
+static long countEntries(int fd)
+{
+	TJournalEntry entry;
+	long count = 0;
+
+	lseek(fd, sizeof(TJournalHeader), SEEK_SET);
+
+	while (read(fd, &entry, sizeof(entry)) == sizeof(entry) && entry.checksum == checksumEntry(&entry))
+		count++;
+
+	lseek(fd, sizeof(TJournalHeader) + count * sizeof(TJournalEntry), SEEK_SET);
+	return count;
+}
+
+int journalOpen(TJournal *journal, const char *filename, unsigned generation, int groupSize)
+{
+	TJournalHeader header;
+
+	int fd = open(filename, O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+		return SAVE_FAIL;
+
+	if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == JOURNAL_MAGIC)
+	{
+		// An existing journal. Cut off anything after the last complete
+		// entry, so that new entries do not end up after a broken one.
+		long count = countEntries(fd);
+
+		if (ftruncate(fd, sizeof(header) + count * sizeof(TJournalEntry)) != 0)
+		{
+			close(fd);
+			return SAVE_FAIL;
+		}
+
+		journal->generation = header.generation;
+	}
+	else
+	{
+		// A new (or empty) journal. Write the header and make sure it is on
+		// disk before any entries are.
+		header.magic = JOURNAL_MAGIC;
+		header.generation = generation;
+
+		if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+			fsync(fd) != 0)
+		{
+			close(fd);
+			return SAVE_FAIL;
+		}
+
+		lseek(fd, sizeof(header), SEEK_SET);
+		journal->generation = generation;
+	}
+
+	if (groupSize < 1)
+		groupSize = 1;
+
+	journal->fd = fd;
+	journal->groupSize = groupSize;
+	journal->numPending = 0;
+	journal->pending = (TJournalEntry *) malloc(groupSize * sizeof(TJournalEntry));
+	return OK;
+}
+
+int journalSync(TJournal *journal)
+{
+	if (journal->numPending == 0)
+		return OK;
+
+	size_t bytes = journal->numPending * sizeof(TJournalEntry);
+
+	// One write and one fsync for the whole group
+	if (write(journal->fd, journal->pending, bytes) != (ssize_t) bytes || fsync(journal->fd) != 0)
+		return SAVE_FAIL;
+
+	journal->numPending = 0;
+	return OK;
+}
+
+int journalAppend(TJournal *journal, int op, const char *name, const char *countryCode, const char *phoneNumber)
+{
+	TJournalEntry *entry = &journal->pending[journal->numPending];
+
+	// Clear the entry first so that the checksum does not depend on
+	// whatever was in the unused parts of the strings.
+	memset(entry, 0, sizeof(TJournalEntry));
+	entry->op = op;
+	strncpy(entry->name, name, NAME_LENGTH - 1);
+
+	if (countryCode != NULL)
+		strncpy(entry->countryCode, countryCode, C_LENGTH - 1);
+
+	if (phoneNumber != NULL)
+		strncpy(entry->phoneNumber, phoneNumber, NUM_LENGTH - 1);
+
+	entry->checksum = checksumEntry(entry);
+	journal->numPending++;
+
+	if (journal->numPending >= journal->groupSize)
+		return journalSync(journal);
+
+	return OK;
+}
+
+void journalClose(TJournal *journal)
+{
+	journalSync(journal);
+	close(journal->fd);
+	free(journal->pending);
+	journal->pending = NULL;
+	journal->fd = -1;
+}
+
+int journalReplay(const char *filename, TJournalApply apply, void *ctx)
+{
+	TJournalHeader header;
+	TJournalEntry entry;
+	int count = 0;
+
+	// We read through stdio here because replay reads the whole file in
+	// order, and stdio does the buffering for us.
+	FILE *fp = fopen(filename, "rb");
+
+	if (fp == NULL)
+		return -1;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != JOURNAL_MAGIC)
+	{
+		fclose(fp);
+		return -1;
+	}
+
+	// A partly written entry can only be at the end, so we stop there
+	while (fread(&entry, sizeof(entry), 1, fp) == 1 && entry.checksum == checksumEntry(&entry))
+	{
+		apply(ctx, &entry);
+		count++;
+	}
+
+	fclose(fp);
+	return count;
+}
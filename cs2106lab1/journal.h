@@ -0,0 +1,86 @@
+// This is the header file for the journal. A journal is a file that we only
+// ever add to. Every time the phonebook changes we append a short entry
+// describing the change, which is much cheaper than saving the whole
+// phonebook again. To get the phonebook back after a crash, we load the last
+// full save (the "snapshot") and apply the journal entries on top of it.
+
+#ifndef JOURNAL
+
+#define JOURNAL
+
+#include "db.h"
+
+// The kinds of entries in a journal
+enum
+{
+	JOURNAL_ADD=1,
+	JOURNAL_DELETE=2
+};
+
+// A journal file starts with a header, followed by entries of a fixed size.
+// Each file has a generation number. Every time the journal is compacted into
+// a new snapshot we start a new file with the next generation number, and the
+// snapshot remembers which generations it already contains.
+
+typedef struct
+{
+	unsigned magic;
+	unsigned generation;
+} TJournalHeader;
+
+typedef struct
+{
+	unsigned op;					// JOURNAL_ADD or JOURNAL_DELETE
+	char name[NAME_LENGTH];
+	char countryCode[C_LENGTH];
+	char phoneNumber[NUM_LENGTH];
+	unsigned checksum;				// Lets us spot an entry that was only partly written
+} TJournalEntry;
+
+// An open journal. Entries are collected in memory and written out with a
+// single write() and fsync() once groupSize of them have built up. fsync
+// waits for the disk, so doing it once per group instead of once per entry
+// makes adding entries many times faster. The price is that a crash can lose
+// the last groupSize-1 changes, unless journalSync is called.
+
+typedef struct
+{
+	int fd;
+	unsigned generation;
+	TJournalEntry *pending;		// Entries not written to the file yet
+	int numPending;
+	int groupSize;
+} TJournal;
+
+// Opens a journal for appending, creating it with the given generation number
+// if it does not exist.
+// Pre: journal is not open. groupSize = number of entries to collect before each fsync.
+// Post: Returns OK if the journal was opened or SAVE_FAIL if not. If the file ends
+// with a partly written entry, the partial entry is cut off.
+int journalOpen(TJournal *journal, const char *filename, unsigned generation, int groupSize);
+
+// Adds an entry to the journal.
+// Pre: journal is open. op = JOURNAL_ADD or JOURNAL_DELETE. For JOURNAL_DELETE only name is used.
+// Post: The entry is added. Returns OK, or SAVE_FAIL if a group could not be written.
+int journalAppend(TJournal *journal, int op, const char *name, const char *countryCode, const char *phoneNumber);
+
+// Writes out and fsyncs all pending entries.
+// Pre: journal is open.
+// Post: Every entry appended so far is on disk. Returns OK or SAVE_FAIL.
+int journalSync(TJournal *journal);
+
+// Syncs and closes a journal.
+// Pre: journal is open.
+// Post: journal is closed.
+void journalClose(TJournal *journal);
+
+// Called by journalReplay for each entry
+typedef void (*TJournalApply)(void *ctx, TJournalEntry *entry);
+
+// Calls apply for every complete entry in a journal file, in order.
+// Pre: None.
+// Post: Returns the number of entries applied, or -1 if the file cannot be read.
+int journalReplay(const char *filename, TJournalApply apply, void *ctx);
+
+// Endif for the #ifndef at the start
+#endif
@@ -5,18 +5,32 @@
 // Include header file to our library that contains all the functions needed by our phonebook.
 #include "db.h"
 
+// Maximum number of matches we show for a prefix search
+#define MAX_MATCHES		10
+
+// Number of people we show at a time when browsing
+#define PAGE_SIZE		10
+
 // These are prototypes to functions we will call inside phonebook.c. Having these prototypes up
 // here allow us to write the main function right at the top. Otherwise the main function will come
 // after all these functions and become hard to find.
 
 void flushInput();
 void showMenu();
-void loadPhonebook();
-void savePhonebook();
+void loadPhonebook(int binary);
+void savePhonebook(int binary);
 void newEntry();
 void displayEntry();
 void listEntries();
 void deleteEntry();
+void prefixSearch();
+void memoryUsage();
+void numberSearch();
+void browseEntries();
+void importEntries();
+void containsSearch();
+void backgroundSave();
+void saveStatus();
 void readName(char *name, int maxlen);
 
 
@@ -48,6 +62,9 @@ int main(int ac, char **av)
 	}
 
 	initPhonebook(numRecords);
+
+	// Large phonebooks take a while to load, so let the user know how it is going
+	setLoadProgress(1);
 	printf("Hello welcome to Phonebook\n");
 	showMenu();
 	printf("\nGoodbye!");
@@ -92,6 +109,16 @@ void showMenu()
 		printf("4. Delete entry\n");	
 		printf("5. Save phonebook\n");	
 		printf("6. Load phonebook\n");	
+		printf("7. Search by prefix\n");
+		printf("8. Save phonebook (binary)\n");
+		printf("9. Load phonebook (binary)\n");
+		printf("10. Memory usage\n");
+		printf("11. Search by phone number\n");
+		printf("12. Browse by name\n");
+		printf("13. Import CSV file\n");
+		printf("14. Search by part of name\n");
+		printf("15. Save phonebook in background\n");
+		printf("16. Background save status\n");
 		printf("0. Quit\n");
 		
 		printf("\n Enter choice: ");
@@ -118,11 +145,51 @@ void showMenu()
 				break;
 
 			case 5:
-				savePhonebook();
+				savePhonebook(0);
 				break;
 
 			case 6:
-				loadPhonebook();
+				loadPhonebook(0);
+				break;
+
+			case 7:
+				prefixSearch();
+				break;
+
+			case 8:
+				savePhonebook(1);
+				break;
+
+			case 9:
+				loadPhonebook(1);
+				break;
+
+			case 10:
+				memoryUsage();
+				break;
+
+			case 11:
+				numberSearch();
+				break;
+
+			case 12:
+				browseEntries();
+				break;
+
+			case 13:
+				importEntries();
+				break;
+
+			case 14:
+				containsSearch();
+				break;
+
+			case 15:
+				backgroundSave();
+				break;
+
+			case 16:
+				saveStatus();
 				break;
 
 			case 0:
@@ -137,8 +204,8 @@ void showMenu()
 
 // Nothing really spectacular going on here: Mostly we are just
 // calling our functions in db.c, then looking at the results and
-// printing appropriate messages.
-void loadPhonebook()
+// printing appropriate messages. binary = 1 to use the binary file format.
+void loadPhonebook(int binary)
 {
 	printf("\nLOAD\n");
 	printf(  "====\n\n");
@@ -149,7 +216,9 @@ void loadPhonebook()
 	flushInput();
 
 	printf("\n");
-	int result = loadDB(filename);
+
+	// We do not verify the checksum, so that loading is instant
+	int result = binary ? loadDBBinary(filename, 0) : loadDB(filename);
 
 	if (result == OK)
 		printf("\n** Load OK! **\n\n");
@@ -157,7 +226,7 @@ void loadPhonebook()
 		printf("\n** Load FAILED! **\n\n");
 }
 
-void savePhonebook()
+void savePhonebook(int binary)
 {
 	printf("\nSAVE\n");
 	printf(  "====\n\n");
@@ -168,7 +237,7 @@ void savePhonebook()
 	flushInput();
 
 	printf("\n");
-	int result = saveDB(filename);
+	int result = binary ? saveDBBinary(filename) : saveDB(filename);
 
 	if (result == OK)
 		printf("** Save OK! **\n\n");
@@ -267,4 +336,210 @@ void deleteEntry()
 		printf("\n** Cannot find %s **\n\n", name);
 }
 
+void prefixSearch()
+{
+	printf("\nPREFIX SEARCH\n");
+	printf(  "=============\n\n");
+
+	char prefix[NAME_LENGTH];
+	TPhonebook matches[MAX_MATCHES];
+
+	printf("Enter start of name: ");
+	readName(prefix, NAME_LENGTH);
+
+	int found = findPrefix(prefix, matches, MAX_MATCHES);
+
+	if (found == 0)
+		printf("\n** No names start with %s **\n\n", prefix);
+	else
+	{
+		printf("\n");
+
+		for (int i=0; i<found; i++)
+			printf("%s (%s)-(%s)\n", matches[i].name, matches[i].countryCode, matches[i].phoneNumber);
+
+		printf("\n");
+	}
+}
+
+void memoryUsage()
+{
+	printf("\nMEMORY USAGE\n");
+	printf(  "============\n\n");
+
+	TDBMemory mem;
+	getDBMemory(&mem);
+
+	printf("Records:      %zu bytes\n", mem.records);
+	printf("Arena:        %zu bytes\n", mem.arena);
+	printf("Countries:    %zu bytes\n", mem.countries);
+	printf("Name index:   %zu bytes\n", mem.nameIndex);
+	printf("Phone index:  %zu bytes\n", mem.phoneIndex);
+	printf("Sorted index: %zu bytes\n", mem.sortedIndex);
+	printf("Free list:    %zu bytes\n", mem.freeList);
+	printf("Total:        %zu bytes\n", mem.total);
+	printf("Grown %d times\n\n", mem.growths);
+}
+
+void numberSearch()
+{
+	printf("\nSEARCH BY PHONE NUMBER\n");
+	printf(  "======================\n\n");
+
+	char countryCode[C_LENGTH];
+	char phoneNumber[NUM_LENGTH];
+
+	printf("Enter country code: ");
+	scanf("%3s", countryCode);
+	flushInput();
+
+	printf("\nEnter phone number: ");
+	scanf("%9s", phoneNumber);
+	flushInput();
+
+	TPhonebook *entry = findNumber(countryCode, phoneNumber);
+
+	if (entry != NULL)
+	{
+		printf("\nName: %s\n", entry->name);
+		printf("Phone: (%s)-(%s)\n\n", entry->countryCode, entry->phoneNumber);
+	}
+	else
+		printf("\n** Nobody has number (%s)-(%s) **\n\n", countryCode, phoneNumber);
+}
+
+// Shows a range of names a page at a time. Each page is read from db.c only
+// when we need it, so browsing a huge phonebook does not list all of it.
+void browseEntries()
+{
+	printf("\nBROWSE\n");
+	printf(  "======\n\n");
+
+	char from[NAME_LENGTH], to[NAME_LENGTH], answer[NAME_LENGTH];
+	TPhonebook page[PAGE_SIZE];
+	TListCursor cursor;
+	int found;
+
+	printf("Enter first name to show (blank to start at the beginning): ");
+	readName(from, NAME_LENGTH);
 
+	printf("Enter name to stop before (blank to go to the end): ");
+	readName(to, NAME_LENGTH);
+
+	printf("\n");
+	startListing(&cursor, from, to);
+
+	while ((found = nextListing(&cursor, page, PAGE_SIZE)) > 0)
+	{
+		for (int i=0; i<found; i++)
+			printf("%s (%s)-(%s)\n", page[i].name, page[i].countryCode, page[i].phoneNumber);
+
+		// A short page means there are no more
+		if (found < PAGE_SIZE)
+			break;
+
+		printf("\nPress Enter for more, or q to stop: ");
+		readName(answer, NAME_LENGTH);
+
+		if (answer[0] == 'q')
+			break;
+
+		printf("\n");
+	}
+
+	printf("\n** End of listing **\n\n");
+}
+
+void importEntries()
+{
+	printf("\nIMPORT\n");
+	printf(  "======\n\n");
+
+	char filename[128];
+	printf("Enter CSV filename: ");
+	scanf("%s", filename);
+	flushInput();
+
+	// Parse with one thread per CPU
+	TImportStats stats;
+	int result = importCSV(filename, 0, &stats);
+
+	printf("\nAdded %d, %d duplicates, %d invalid lines\n", stats.added, stats.duplicates, stats.invalid);
+
+	if (result == OK)
+		printf("\n** Import OK! **\n\n");
+	else if (result == MAX_REACHED)
+		printf("\n** ERR: Maximum records reached. **\n\n");
+	else
+		printf("\n** Import FAILED! **\n\n");
+}
+
+void containsSearch()
+{
+	printf("\nSEARCH BY PART OF NAME\n");
+	printf(  "======================\n\n");
+
+	char text[NAME_LENGTH], answer[NAME_LENGTH];
+	TPhonebook matches[MAX_MATCHES];
+
+	printf("Enter part of name: ");
+	readName(text, NAME_LENGTH);
+
+	printf("Ignore case (y/n)? ");
+	readName(answer, NAME_LENGTH);
+
+	int found = findContaining(text, answer[0] == 'y', matches, MAX_MATCHES);
+
+	if (found == 0)
+		printf("\n** No names contain %s **\n\n", text);
+	else
+	{
+		printf("\n");
+
+		for (int i=0; i<found && i<MAX_MATCHES; i++)
+			printf("%s (%s)-(%s)\n", matches[i].name, matches[i].countryCode, matches[i].phoneNumber);
+
+		if (found > MAX_MATCHES)
+			printf("... and %d more\n", found - MAX_MATCHES);
+
+		printf("\n");
+	}
+}
+
+// Starts a save and goes straight back to the menu. Use saveStatus to see
+// when it is done.
+void backgroundSave()
+{
+	printf("\nBACKGROUND SAVE\n");
+	printf(  "===============\n\n");
+
+	char filename[128], answer[NAME_LENGTH];
+	printf("Enter phonebook filename: ");
+	scanf("%s", filename);
+	flushInput();
+
+	printf("Binary format (y/n)? ");
+	readName(answer, NAME_LENGTH);
+
+	if (saveDBBackground(filename, answer[0] == 'y') == OK)
+		printf("\n** Save started **\n\n");
+	else
+		printf("\n** Cannot start save. Is another one still running? **\n\n");
+}
+
+void saveStatus()
+{
+	switch(getSaveStatus())
+	{
+		case SAVE_RUNNING:
+			printf("\n** Save still running **\n\n");
+			break;
+
+		case OK:
+			printf("\n** Last save OK! **\n\n");
+			break;
+
+		default:
+			printf("\n** Last save FAILED! **\n\n");
+	}
+}
@@ -0,0 +1,85 @@
+// Checks that reader slots are given back when reader threads exit. We start
+// many more short-lived reader threads than there are slots, the way the web
+// server in cs2106lab5 starts a thread for every request, and check that they
+// keep getting slots instead of falling back on the writer lock.
+//
+// We include db.c itself rather than link with db.o, so that we can look at
+// numReaders and readerId, which are static in db.c.
+#include "db.c"
+
+// How many reader threads we start, and how many run at the same time
+#define NUM_THREADS		(4 * MAX_READERS)
+#define BATCH			8
+
+// Number of people in each phonebook, and lookups done by each thread
+#define NUM_PEOPLE		100
+#define NUM_LOOKUPS		20
+
+#define NUM_BOOKS		3
+
+static TPhonebookDB *books[NUM_BOOKS];
+static int failures = 0;
+
+// Looks up some people in every phonebook, and checks that this thread got
+// a reader slot.
+static void *readerMain(void *arg)
+{
+	int start = (int) (intptr_t) arg, i, j;
+	char name[NAME_LENGTH];
+	TPhonebook person;
+
+	for (i=0; i<NUM_LOOKUPS; i++)
+		for (j=0; j<NUM_BOOKS; j++)
+		{
+			sprintf(name, "Person %d", (start + i) % NUM_PEOPLE);
+
+			if (dbFindPersonCopy(books[j], name, &person) != OK || strcmp(person.name, name) != 0)
+				__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+		}
+
+	if (readerId < 0 || readerId >= MAX_READERS)
+		__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_t threads[BATCH];
+	char name[NAME_LENGTH];
+	int i, j, result;
+
+	for (j=0; j<NUM_BOOKS; j++)
+	{
+		books[j] = dbCreate();
+		dbInitPhonebook(books[j], NUM_PEOPLE);
+		dbSetConcurrent(books[j], 1);
+
+		for (i=0; i<NUM_PEOPLE; i++)
+		{
+			sprintf(name, "Person %d", i);
+			dbAddPerson(books[j], name, "65", "12345678", &result);
+		}
+	}
+
+	for (i=0; i<NUM_THREADS; i += BATCH)
+	{
+		for (j=0; j<BATCH; j++)
+			pthread_create(&threads[j], NULL, readerMain, (void *) (intptr_t) (i + j));
+
+		for (j=0; j<BATCH; j++)
+			pthread_join(threads[j], NULL);
+	}
+
+	// Only BATCH threads were ever reading at once, so no more slots than
+	// that should have been handed out.
+	if (numReaders > BATCH)
+		failures++;
+
+	printf("%d reader threads, %d slots used, %d failures\n", NUM_THREADS, numReaders, failures);
+
+	for (j=0; j<NUM_BOOKS; j++)
+		dbDestroy(books[j]);
+
+	return (failures == 0) ? 0 : 1;
+}
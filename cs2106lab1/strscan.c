@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+#include "strscan.h"
+
+// The vector kernels are only for x86 CPUs. We compile them with the target
+// attribute rather than with -mavx2 for the whole file, so that the rest of
+// the program still runs on CPUs without AVX2.
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// The kernel scanMatch uses, chosen by scanUseKernel
+static int activeKernel = SCAN_AUTO;
+
+static inline unsigned char lowerByte(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+// Checks the pattern against str in full. The kernels have already checked
+// the first and the last byte, so we only look at the ones in between.
+static int matchMiddle(const TScanPattern *pattern, const char *str)
+{
+	int i;
+
+	if (pattern->length <= 2)
+		return 1;
+
+	if (!pattern->ignoreCase)
+		return memcmp(str + 1, pattern->text + 1, pattern->length - 2) == 0;
+
+	for (i=1; i<pattern->length - 1; i++)
+		if (lowerByte(str[i]) != (unsigned char) pattern->text[i])
+			return 0;
+
+	return 1;
+}
+
+// Looks for the pattern one position at a time, starting at position from
+static int matchScalar(const TScanPattern *pattern, const char *str, int from, int length)
+{
+	int m = pattern->length, i;
+	unsigned char first = pattern->text[0], last = pattern->text[m - 1];
+
+	for (i=from; i + m <= length; i++)
+	{
+		unsigned char a = str[i], b = str[i + m - 1];
+
+		if (pattern->ignoreCase)
+		{
+			a = lowerByte(a);
+			b = lowerByte(b);
+		}
+
+		if (a == first && b == last && matchMiddle(pattern, str + i))
+			return 1;
+	}
+
+	return 0;
+}
+
+#ifdef SCAN_X86
+
+// Turns the letters A to Z in a block into lower case. Bytes from 128 up are
+// negative as signed bytes, so the compares leave them alone.
+__attribute__((target("sse2")))
+static inline __m128i lower128(__m128i v)
+{
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+// Checks 16 positions at a time. Bit j of mask is set if position i + j
+// has the right first byte and the right last byte.
+__attribute__((target("sse2")))
+static int matchSSE2(const TScanPattern *pattern, const char *str, int length, const char *limit)
+{
+	int m = pattern->length, i;
+	__m128i first = _mm_set1_epi8(pattern->text[0]);
+	__m128i last = _mm_set1_epi8(pattern->text[m - 1]);
+
+	for (i=0; i + m <= length; i += 16)
+	{
+		// The block of last bytes would run past limit, so finish off slowly
+		if (limit - (str + i) < m - 1 + 16)
+			return matchScalar(pattern, str, i, length);
+
+		__m128i a = _mm_loadu_si128((const __m128i *) (str + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (str + i + m - 1));
+
+		if (pattern->ignoreCase)
+		{
+			a = lower128(a);
+			b = lower128(b);
+		}
+
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+		// Drop positions where the pattern would run past the end of str
+		int valid = length - m + 1 - i;
+
+		if (valid < 16)
+			mask &= (1u << valid) - 1;
+
+		while (mask)
+		{
+			if (matchMiddle(pattern, str + i + __builtin_ctz(mask)))
+				return 1;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return 0;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lower256(__m256i v)
+{
+	__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+
+	return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+// Same as matchSSE2, but 32 positions at a time
+__attribute__((target("avx2")))
+static int matchAVX2(const TScanPattern *pattern, const char *str, int length, const char *limit)
+{
+	int m = pattern->length, i;
+	__m256i first = _mm256_set1_epi8(pattern->text[0]);
+	__m256i last = _mm256_set1_epi8(pattern->text[m - 1]);
+
+	for (i=0; i + m <= length; i += 32)
+	{
+		if (limit - (str + i) < m - 1 + 32)
+			return matchScalar(pattern, str, i, length);
+
+		__m256i a = _mm256_loadu_si256((const __m256i *) (str + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (str + i + m - 1));
+
+		if (pattern->ignoreCase)
+		{
+			a = lower256(a);
+			b = lower256(b);
+		}
+
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		int valid = length - m + 1 - i;
+
+		if (valid < 32)
+			mask &= (1u << valid) - 1;
+
+		while (mask)
+		{
+			if (matchMiddle(pattern, str + i + __builtin_ctz(mask)))
+				return 1;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return 0;
+}
+
+#endif
+
+int scanUseKernel(int kernel)
+{
+	int best = SCAN_SCALAR;
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		best = SCAN_AVX2;
+	else if (__builtin_cpu_supports("sse2"))
+		best = SCAN_SSE2;
+#endif
+
+	if (kernel == SCAN_AUTO || kernel > best)
+		kernel = best;
+
+	activeKernel = kernel;
+	return kernel;
+}
+
+int scanInit(TScanPattern *pattern, const char *text, int ignoreCase)
+{
+	int i;
+
+	if (activeKernel == SCAN_AUTO)
+		scanUseKernel(SCAN_AUTO);
+
+	pattern->length = strlen(text);
+	pattern->ignoreCase = ignoreCase;
+	pattern->text = (char *) malloc(pattern->length + 1);
+
+	if (pattern->text == NULL)
+		return -1;
+
+	for (i=0; i<=pattern->length; i++)
+		pattern->text[i] = ignoreCase ? lowerByte(text[i]) : text[i];
+
+	return 0;
+}
+
+void scanFree(TScanPattern *pattern)
+{
+	free(pattern->text);
+	pattern->text = NULL;
+}
+
+int scanMatch(const TScanPattern *pattern, const char *str, int length, const char *limit)
+{
+	if (pattern->length == 0)
+		return 1;
+
+	if (pattern->length > length)
+		return 0;
+
+	switch (activeKernel)
+	{
+#ifdef SCAN_X86
+		case SCAN_AVX2:
+			return matchAVX2(pattern, str, length, limit);
+
+		case SCAN_SSE2:
+			return matchSSE2(pattern, str, length, limit);
+#endif
+
+		default:
+			return matchScalar(pattern, str, 0, length);
+	}
+}
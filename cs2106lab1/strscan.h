@@ -0,0 +1,58 @@
+// This is the header file for a substring scanner, which checks whether a
+// string contains some piece of text, e.g. whether "Tan Ah Kow" contains "ah".
+//
+// Checking one position at a time, like strstr does, is slow when we have to
+// check millions of names. Instead we use the vector instructions of the CPU,
+// which compare 16 (SSE2) or 32 (AVX2) bytes in one go. For every position in
+// a block of the string we compare the first and the last byte of the text at
+// once, and only the few positions where both match are checked in full. Which
+// instructions we use is decided when the program runs, so the same program
+// works on CPUs that do not have AVX2, and on CPUs that are not x86 at all.
+
+#ifndef STRSCAN
+
+#define STRSCAN
+
+// Kernels for scanUseKernel
+enum
+{
+	SCAN_AUTO=0,		// The fastest one this CPU has
+	SCAN_SCALAR=1,		// One byte at a time
+	SCAN_SSE2=2,		// 16 bytes at a time
+	SCAN_AVX2=3			// 32 bytes at a time
+};
+
+// Text to look for. Only strscan.c should look inside.
+typedef struct
+{
+	char *text;			// In lower case if ignoreCase is set
+	int length;
+	int ignoreCase;
+} TScanPattern;
+
+// Sets up a pattern.
+// Pre: text = text to look for. ignoreCase = 1 if "AH" should match "Ah", which only works for the letters A to Z.
+// Post: pattern is ready for scanMatch. Returns 0, or -1 if there is not enough memory.
+int scanInit(TScanPattern *pattern, const char *text, int ignoreCase);
+
+// Frees a pattern.
+// Pre: pattern was set up by scanInit.
+// Post: Memory used by pattern is freed.
+void scanFree(TScanPattern *pattern);
+
+// Checks whether a string contains the pattern. Every string contains the empty text.
+// Pre: pattern was set up by scanInit. str = string of length bytes. limit = end of the
+// memory str is in, so that we can read a whole block past the end of str when it is
+// safe, rather than stop and check the last few bytes one at a time.
+// Post: Returns 1 if the pattern is somewhere in str, 0 otherwise.
+int scanMatch(const TScanPattern *pattern, const char *str, int length, const char *limit);
+
+// Chooses which kernel scanMatch uses. This is mostly useful for testing and for
+// timing the kernels against each other.
+// Pre: kernel = SCAN_AUTO, SCAN_SCALAR, SCAN_SSE2 or SCAN_AVX2.
+// Post: scanMatch uses kernel, or the fastest one below it that this CPU has.
+// Returns the kernel chosen.
+int scanUseKernel(int kernel);
+
+// Endif for the #ifndef at the start
+#endif
@@ -7,12 +7,18 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <time.h>
 #include <stdarg.h>
 #include <pthread.h>
 #include "buffer.h"
 
+// The phonebook from lab 1. Build its .c files with gcc and link them in:
+//   gcc -O2 -c ../cs2106lab1/db.c ../cs2106lab1/dbcompat.c ../cs2106lab1/hashidx.c ../cs2106lab1/btree.c ../cs2106lab1/journal.c ../cs2106lab1/strscan.c
+//   g++ -O2 -fpermissive -o lab3p3 lab3p3.cpp buffer.cpp db.o dbcompat.o hashidx.o btree.o journal.o strscan.o -lpthread
+#include "../cs2106lab1/db.h"
+
 // Port Number
 #define PORTNUM			80
 
@@ -28,8 +34,15 @@
 // Maximum length of a log entry
 #define LOG_BUFFER_LEN	1024
 
-// Maximum length of a filename
-#define MAX_FILENAME_LEN	128
+// Maximum length of a filename. Phonebook queries put URL encoded names
+// here, which can be three times as long as the names themselves.
+#define MAX_FILENAME_LEN	512
+
+// Maximum number of people returned by a prefix search
+#define MAX_MATCHES		100
+
+// Number of connections waiting to be accepted
+#define LISTEN_BACKLOG	SOMAXCONN
 
 // HTTP methods
 enum
@@ -42,8 +55,9 @@ enum
 
 void startServer(uint16_t portNum);
 void formHTTPResponse(char *buffer, uint16_t maxBufferLen, uint16_t returnCode, 
-	char *returnMessage, char *body, uint16_t bodyLength);
+	const char *returnMessage, char *body, uint16_t bodyLength, const char *contentType);
 void *deliverHTTP(void *connfd);
+int servePhonebook(const char *filename, char *HTTPBuffer);
 char *getCurrentTime();
 void writeLog(const char *format, ...);
 void parseHTTP(const char *buffer, int *method, char *filename);
@@ -59,18 +73,39 @@ char logBuffer[LOG_BUFFER_LEN];
 
 TBuffer buffer;
 
+// Usage: lab3p3 [phonebook file] [port number]
+// The phonebook is loaded once here, and queries are answered from memory.
 int main(int ac, char **av)
 {
+	uint16_t portNum = PORTNUM;
+
 	logfptr = fopen("webserver.log", "w");
 	if(logfptr == NULL)
 	{
 		fprintf(stderr, "Cannot open log file\n");
 		exit(-1);
 	}
+
+	// The file may come from anywhere, so we have loadDBBinary check its
+	// checksum too before we answer requests from it
+	initPhonebook(1);
+	if(ac > 1 && loadDBBinary(av[1], 1) != OK && loadDB(av[1]) != OK)
+	{
+		fprintf(stderr, "Cannot load phonebook %s\n", av[1]);
+		exit(-1);
+	}
+
+	// Every connection has its own thread, so the threads must be able to
+	// look people up at the same time
+	setConcurrent(1);
+
+	if(ac > 2)
+		portNum = atoi(av[2]);
+
 	initBuffer(&buffer);
 	pthread_t loggerThread;
 	pthread_create(&loggerThread, NULL, logger, NULL);
-	startServer(PORTNUM);
+	startServer(portNum);
 }
 
 char *getCurrentTime()
@@ -86,16 +121,19 @@ char *getCurrentTime()
 }
 
 void formHTTPResponse(char *buffer, uint16_t maxBufferLen, uint16_t returnCode, 
-	char *returnMessage, char *body, uint16_t bodyLength)
+	const char *returnMessage, char *body, uint16_t bodyLength, const char *contentType)
 {
 	sprintf(buffer, "HTTP/1.1 %d %s\n", returnCode,
 		returnMessage);
 	sprintf(buffer, "%sDate: %s\n", buffer, getCurrentTime());
 	sprintf(buffer, "%sServer: CS2106/1.1.0\n", buffer);
 	sprintf(buffer, "%sContent-Length: %d\n", buffer, bodyLength);
-	sprintf(buffer, "%sContent-Type: text/html\n", buffer);
+	sprintf(buffer, "%sContent-Type: %s\n", buffer, contentType);
 	sprintf(buffer, "%sConnection: Closed\n", buffer);
-	sprintf(buffer, "%s\n\n%s\n", buffer, body);
+
+	// One blank line ends the headers. Anything more would be counted as
+	// part of the body, and then Content-Length would be wrong.
+	sprintf(buffer, "%s\n%s", buffer, body != NULL ? body : "");
 	writeLog("Response: %d:%s", returnCode, returnMessage);
 }
 
@@ -151,29 +189,188 @@ void parseHTTP(const char *buffer, int *method, char *filename)
 	if(fname != NULL)
 	{
 		printf("Copying filename\n");
-		strncpy(filename, fname, MAX_FILENAME_LEN);
+		strncpy(filename, fname, MAX_FILENAME_LEN - 1);
+		filename[MAX_FILENAME_LEN - 1] = '\0';
 		printf("Done. Filename is %s\n", filename);
 	}
 }
 
+// Decodes a URL encoded string, e.g. "Tan+Ah%20Kow" becomes "Tan Ah Kow".
+// Stops at the end of src or at the first '&'. A '%' that is not followed
+// by two hex digits is copied as it is.
+void urlDecode(const char *src, char *dest, int maxLen)
+{
+	int len = 0;
+
+	while(*src != '\0' && *src != '&' && len < maxLen - 1)
+	{
+		unsigned int ch;
+
+		if(*src == '%' && isxdigit((unsigned char) src[1]) && isxdigit((unsigned char) src[2]) &&
+			sscanf(src + 1, "%2x", &ch) == 1)
+		{
+			dest[len++] = (char) ch;
+			src += 3;
+		}
+		else
+		{
+			dest[len++] = (*src == '+') ? ' ' : *src;
+			src++;
+		}
+	}
+
+	dest[len] = '\0';
+}
+
+// Finds parameter "param" in the query string of a URL and decodes its
+// value into value. Returns 1 if found, or 0 if not.
+int getQueryParam(const char *url, const char *param, char *value, int maxLen)
+{
+	const char *query = strchr(url, '?');
+	int paramLen = strlen(param);
+
+	while(query != NULL)
+	{
+		query++;
+
+		if(strncmp(query, param, paramLen) == 0 && query[paramLen] == '=')
+		{
+			urlDecode(query + paramLen + 1, value, maxLen);
+			return 1;
+		}
+
+		query = strchr(query, '&');
+	}
+
+	return 0;
+}
+
+// Appends str to buffer as a JSON string, with quotes around it and any
+// characters JSON does not allow escaped.
+int writeJSONString(char *buffer, const char *str)
+{
+	int len = 0;
+
+	buffer[len++] = '"';
+
+	for(; *str != '\0'; str++)
+	{
+		if(*str == '"' || *str == '\\')
+		{
+			buffer[len++] = '\\';
+			buffer[len++] = *str;
+		}
+		else if((unsigned char) *str < 0x20)
+			len += sprintf(buffer + len, "\\u%04x", (unsigned char) *str);
+		else
+			buffer[len++] = *str;
+	}
+
+	buffer[len++] = '"';
+	buffer[len] = '\0';
+	return len;
+}
+
+// Writes a person as a JSON object and returns its length
+int writePersonJSON(char *buffer, TPhonebook *person)
+{
+	int len = 0;
+
+	len += sprintf(buffer + len, "{\"name\":");
+	len += writeJSONString(buffer + len, person->name);
+	len += sprintf(buffer + len, ",\"countryCode\":");
+	len += writeJSONString(buffer + len, person->countryCode);
+	len += sprintf(buffer + len, ",\"phoneNumber\":");
+	len += writeJSONString(buffer + len, person->phoneNumber);
+	len += sprintf(buffer + len, "}");
+	return len;
+}
+
+// Answers phonebook queries straight from memory:
+//   GET /person?name=<name>		the person with that name, or 404
+//   GET /prefix?name=<prefix>		up to MAX_MATCHES people whose names start with prefix
+// Returns 1 if filename was a phonebook query and the response is in
+// HTTPBuffer, or 0 if it is an ordinary file.
+int servePhonebook(const char *filename, char *HTTPBuffer)
+{
+	char body[MAX_FILE_SIZE];
+	char name[NAME_LENGTH];
+	int len = 0;
+
+	if(strncmp(filename, "/person?", 8) == 0)
+	{
+		TPhonebook person;
+
+		if(!getQueryParam(filename, "name", name, NAME_LENGTH))
+		{
+			sprintf(body, "{\"error\":\"name is missing\"}");
+			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 400, "BAD REQUEST", body, strlen(body), "application/json");
+		}
+		else if(findPersonCopy(name, &person) != OK)
+		{
+			len = sprintf(body, "{\"error\":\"not found\",\"name\":");
+			len += writeJSONString(body + len, name);
+			sprintf(body + len, "}");
+			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 404, "NOT FOUND", body, strlen(body), "application/json");
+		}
+		else
+		{
+			writePersonJSON(body, &person);
+			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", body, strlen(body), "application/json");
+		}
+
+		return 1;
+	}
+
+	if(strncmp(filename, "/prefix?", 8) == 0)
+	{
+		// Nothing changes the phonebook while the server runs, so findPrefix
+		// is safe to call from several threads at once. Each person takes at
+		// most about 6 times NAME_LENGTH bytes of JSON, which fits in body.
+		TPhonebook matches[MAX_MATCHES];
+		int found = 0, i;
+
+		if(getQueryParam(filename, "name", name, NAME_LENGTH))
+			found = findPrefix(name, matches, MAX_MATCHES);
+
+		body[len++] = '[';
+
+		for(i=0; i<found; i++)
+		{
+			if(i > 0)
+				body[len++] = ',';
+
+			len += writePersonJSON(body + len, &matches[i]);
+		}
+
+		body[len++] = ']';
+		body[len] = '\0';
+		formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", body, len, "application/json");
+		return 1;
+	}
+
+	return 0;
+}
+
 void *deliverHTTP(void *connfd)
 {
 	FILE *fptr;
 	char HTTPBuffer[MAX_BUFFER_LEN];
 	char fileBuffer[MAX_FILE_SIZE];
 
-	read(connfd, HTTPBuffer, MAX_BUFFER_LEN);
+	int bytesRead = read(connfd, HTTPBuffer, MAX_BUFFER_LEN - 1);
+	HTTPBuffer[bytesRead > 0 ? bytesRead : 0] = '\0';
 
 	int method;
-	char filename[MAX_FILENAME_LEN];
-	char fetchName[MAX_FILENAME_LEN];
+	char filename[MAX_FILENAME_LEN] = "/";
+	char fetchName[MAX_FILENAME_LEN + 1];
 
 	parseHTTP(HTTPBuffer, &method, filename);
 	printf("Method = %d filename = %s\n", method,filename);
 
 	if(method == HEAD)
-		formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", NULL, 0);
-	else
+		formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", NULL, 0, "text/html");
+	else if(!servePhonebook(filename, HTTPBuffer))
 	{
 		if(strcmp(filename, "/") == 0)
 			strcpy(fetchName, "./index.html");
@@ -186,13 +383,13 @@ void *deliverHTTP(void *connfd)
 		{
 			writeLog("Cannot find %s", filename);
 			sprintf(fileBuffer,"<html><body><h1>%s NOT FOUND</h1></body></html>", filename);
-			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 404, "NOT FOUND", fileBuffer, strlen(fileBuffer));
+			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 404, "NOT FOUND", fileBuffer, strlen(fileBuffer), "text/html");
 		}
 		else
 		{
 			readHTML(fptr, fileBuffer, MAX_FILE_SIZE);
 			fclose(fptr);
-			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", fileBuffer, strlen(fileBuffer));
+			formHTTPResponse(HTTPBuffer, MAX_BUFFER_LEN, 200, "OK", fileBuffer, strlen(fileBuffer), "text/html");
 			writeLog("Serving %s", HTTPBuffer);
 		}
 	}
@@ -259,7 +456,7 @@ void startServer(uint16_t portNum)
 		exit(-1);
 	}
 
-	if(listen(listenfd, 10)<0)
+	if(listen(listenfd, LISTEN_BACKLOG)<0)
 	{
 		perror("Unable to listen.");
 		exit(-1);